@@ -24,12 +24,15 @@ https://github.com/ccrma/chugins/tree/main/Faust which is MIT-Licensed.
 #include <limits.h>
 #include <stdio.h>
 
+#include <atomic>
 #include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 using namespace std;
 
@@ -122,6 +125,105 @@ std::vector<std::string> splitArguments(const std::string& args) {
     return result;
 }
 
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPBatchRenderer
+// desc: Offline rendering of the compiled DSP for the Python renderBatch
+//       method: one instance per worker thread, each rendering whole rows of
+//       a parameter matrix in large blocks straight into the output buffer.
+//       Instances are created on the calling thread; render() touches no
+//       Python objects, so it can run without the GIL.
+//-----------------------------------------------------------------------------
+class FaustCHOPBatchRenderer {
+ public:
+  static const int kBlockSize = 4096;
+
+  FaustCHOPBatchRenderer(llvm_dsp_factory* factory, int sampleRate,
+                         int numThreads, const std::string& soundDirectory,
+                         const FaustCHOPStream::Settings& stream)
+      : m_sampleRate(sampleRate) {
+    if (!soundDirectory.empty()) {
+      // No loader pool: soundfiles must be loaded before rendering starts.
+      m_soundUI = std::make_unique<FaustCHOPSoundUI>(soundDirectory,
+                                                     sampleRate, nullptr,
+                                                     stream);
+    }
+    for (int i = 0; i < numThreads; i++) {
+      std::unique_ptr<dsp> instance(factory->createDSPInstance());
+      if (!instance) {
+        break;
+      }
+      Worker worker;
+      FaustCHOPUI ui;
+      std::vector<std::string> paths;
+      instance->buildUserInterface(&ui);
+      ui.getZones(false, paths, worker.zones);
+      if (m_soundUI) {
+        instance->buildUserInterface(m_soundUI.get());
+      }
+      instance->init(sampleRate);
+      worker.instance = std::move(instance);
+      m_workers.push_back(std::move(worker));
+    }
+  }
+
+  bool isValid() const { return !m_workers.empty(); }
+  int getNumInputs() const { return m_workers[0].instance->getNumInputs(); }
+  int getNumOutputs() const { return m_workers[0].instance->getNumOutputs(); }
+  int getNumParams() const { return (int)m_workers[0].zones.size(); }
+
+  // Row r of `params` (in paramPaths order; missing columns keep their
+  // defaults) renders into out[r][channel][numSamples]. `input` holds
+  // numSamples samples per DSP input, shared by every row.
+  void render(const FAUSTFLOAT* params, int rows, int cols,
+              const FAUSTFLOAT* input, int numSamples, FAUSTFLOAT* out) {
+    std::atomic<int> nextRow{0};
+    auto work = [&](Worker& worker) {
+      const int numInputs = worker.instance->getNumInputs();
+      const int numOutputs = worker.instance->getNumOutputs();
+      std::vector<FAUSTFLOAT*> inputs(numInputs), outputs(numOutputs);
+      for (int row; (row = nextRow++) < rows;) {
+        // A fresh state for every row.
+        worker.instance->instanceInit(m_sampleRate);
+        for (int c = 0; c < cols; c++) {
+          *worker.zones[c] = params[(size_t)row * cols + c];
+        }
+        for (int i = 0; i < numSamples; i += kBlockSize) {
+          const int n = std::min(kBlockSize, numSamples - i);
+          for (int chan = 0; chan < numInputs; chan++) {
+            inputs[chan] =
+                const_cast<FAUSTFLOAT*>(input) + (size_t)chan * numSamples + i;
+          }
+          for (int chan = 0; chan < numOutputs; chan++) {
+            outputs[chan] =
+                out + ((size_t)row * numOutputs + chan) * numSamples + i;
+          }
+          worker.instance->compute(n, inputs.data(), outputs.data());
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < m_workers.size() && (int)i < rows; i++) {
+      threads.emplace_back(work, std::ref(m_workers[i]));
+    }
+    work(m_workers[0]);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+ private:
+  struct Worker {
+    std::unique_ptr<dsp> instance;
+    std::vector<FAUSTFLOAT*> zones;
+  };
+
+  int m_sampleRate;
+  std::unique_ptr<FaustCHOPSoundUI> m_soundUI;
+  // Destroyed before m_soundUI, which owns their soundfiles.
+  std::vector<Worker> m_workers;
+};
+
 #define FAIL_IN_CUSTOM_OPERATOR_METHOD \
   Py_INCREF(Py_None);                  \
   return Py_None;
@@ -331,6 +433,195 @@ static PyObject* pySendControl(PyObject* self, PyObject* args, void*) {
   FAIL_IN_CUSTOM_OPERATOR_METHOD
 }
 
+static PyObject* pySendEvents(PyObject* self, PyObject* args, void*) {
+  PY_Struct* me = (PY_Struct*)self;
+
+  PY_GetInfo info;
+  info.autoCook = false;
+  FaustCHOP* fCHOP = (FaustCHOP*)me->context->getNodeInstance(info);
+  if (fCHOP) {
+    PyObject* oEvents = nullptr;
+    if (!PyArg_UnpackTuple(args, "ref", 1, 1, &oEvents)) {
+      return nullptr;
+    }
+
+    std::vector<FaustCHOPMidiEvent> events;
+    if (!FaustCHOPPyEvents::parse(oEvents, events)) {
+      return nullptr;
+    }
+    fCHOP->sendEvents(events);
+    // Once for the whole batch.
+    me->context->makeNodeDirty();
+  }
+
+  FAIL_IN_CUSTOM_OPERATOR_METHOD
+}
+
+// renderBatch(param_matrix, num_samples, input=None) -> numpy.ndarray
+static PyObject* pyRenderBatch(PyObject* self, PyObject* args, void*) {
+  PY_Struct* me = (PY_Struct*)self;
+
+  PY_GetInfo info;
+  info.autoCook = false;
+  FaustCHOP* fCHOP = (FaustCHOP*)me->context->getNodeInstance(info);
+  if (!fCHOP) {
+    FAIL_IN_CUSTOM_OPERATOR_METHOD
+  }
+
+  PyObject* oParams = nullptr;
+  PyObject* oNumSamples = nullptr;
+  PyObject* oInput = nullptr;
+  if (!PyArg_UnpackTuple(args, "renderBatch", 2, 3, &oParams, &oNumSamples,
+                         &oInput)) {
+    return nullptr;
+  }
+  const long numSamples = PyLong_AsLong(oNumSamples);
+  if (numSamples == -1 && PyErr_Occurred()) {
+    return nullptr;
+  }
+  if (numSamples < 0 || numSamples > INT_MAX) {
+    PyErr_SetString(PyExc_ValueError, "num_samples is out of range");
+    return nullptr;
+  }
+
+  std::vector<FAUSTFLOAT> params;
+  Py_ssize_t rows = 0, cols = 0;
+  if (!FaustCHOPPyMatrix::parse(oParams, "param_matrix", params, rows, cols)) {
+    return nullptr;
+  }
+
+  std::string error;
+  std::unique_ptr<FaustCHOPBatchRenderer> renderer(
+      fCHOP->createBatchRenderer((int)rows, error));
+  if (!renderer) {
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return nullptr;
+  }
+  if (cols > renderer->getNumParams()) {
+    PyErr_Format(PyExc_ValueError,
+                 "param_matrix has %zd columns but the DSP has %d parameters",
+                 cols, renderer->getNumParams());
+    return nullptr;
+  }
+
+  // Inputs are copied once, padded or cut to num_samples.
+  const int numInputs = renderer->getNumInputs();
+  std::vector<FAUSTFLOAT> input((size_t)numInputs * numSamples, 0);
+  if (oInput && oInput != Py_None) {
+    std::vector<FAUSTFLOAT> given;
+    Py_ssize_t channels = 0, length = 0;
+    if (!FaustCHOPPyMatrix::parse(oInput, "input", given, channels, length)) {
+      return nullptr;
+    }
+    for (Py_ssize_t chan = 0; chan < std::min<Py_ssize_t>(channels, numInputs);
+         chan++) {
+      std::copy_n(given.begin() + chan * length,
+                  std::min<Py_ssize_t>(length, numSamples),
+                  input.begin() + chan * numSamples);
+    }
+  }
+
+  const int numOutputs = renderer->getNumOutputs();
+  PyObject* bytes = PyByteArray_FromStringAndSize(
+      nullptr,
+      (Py_ssize_t)(rows * numOutputs * numSamples * sizeof(FAUSTFLOAT)));
+  if (!bytes) {
+    return nullptr;
+  }
+  FAUSTFLOAT* out = (FAUSTFLOAT*)PyByteArray_AS_STRING(bytes);
+
+  Py_BEGIN_ALLOW_THREADS;
+  renderer->render(params.data(), (int)rows, (int)cols, input.data(),
+                   (int)numSamples, out);
+  Py_END_ALLOW_THREADS;
+  renderer.reset();
+
+  // Shape the buffer as an array without copying it: numpy if it's there,
+  // otherwise a memoryview.
+  PyObject* result = nullptr;
+  PyObject* numpy = PyImport_ImportModule("numpy");
+  if (numpy) {
+    PyObject* flat = PyObject_CallMethod(numpy, "frombuffer", "Os", bytes,
+                                         sizeof(FAUSTFLOAT) == 4 ? "float32"
+                                                                 : "float64");
+    if (flat) {
+      result = PyObject_CallMethod(flat, "reshape", "nnn", rows,
+                                   (Py_ssize_t)numOutputs,
+                                   (Py_ssize_t)numSamples);
+      Py_DECREF(flat);
+    }
+    Py_DECREF(numpy);
+  } else {
+    PyErr_Clear();
+    PyObject* view = PyMemoryView_FromObject(bytes);
+    if (view) {
+      result = PyObject_CallMethod(
+          view, "cast", "s(nnn)", sizeof(FAUSTFLOAT) == 4 ? "f" : "d", rows,
+          (Py_ssize_t)numOutputs, (Py_ssize_t)numSamples);
+      Py_DECREF(view);
+    }
+  }
+  Py_DECREF(bytes);
+  return result;
+}
+
+// dumpTrace(path=None) -> str
+static PyObject* pyDumpTrace(PyObject* self, PyObject* args, void*) {
+  PY_Struct* me = (PY_Struct*)self;
+
+  PY_GetInfo info;
+  info.autoCook = false;
+  FaustCHOP* fCHOP = (FaustCHOP*)me->context->getNodeInstance(info);
+  if (!fCHOP) {
+    FAIL_IN_CUSTOM_OPERATOR_METHOD
+  }
+
+  const char* path = nullptr;
+  if (!PyArg_ParseTuple(args, "|z:dumpTrace", &path)) {
+    return nullptr;
+  }
+  std::string written = path ? path : "";
+  std::string error;
+  if (!fCHOP->dumpTrace(written, error)) {
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return nullptr;
+  }
+  return PyUnicode_FromString(written.c_str());
+}
+
+// Getters for FaustCHOPZoneViews. They return None until a DSP is compiled.
+#define ZONE_VIEW_GETTER(name)                                          \
+  static PyObject* pyGet_##name(PyObject* self, void*) {                \
+    PY_Struct* me = (PY_Struct*)self;                                   \
+    PY_GetInfo info;                                                    \
+    info.autoCook = false;                                              \
+    FaustCHOP* fCHOP = (FaustCHOP*)me->context->getNodeInstance(info); \
+    if (!fCHOP) {                                                       \
+      Py_RETURN_NONE;                                                   \
+    }                                                                   \
+    return fCHOP->getZoneViews().name();                                \
+  }
+
+ZONE_VIEW_GETTER(paramValues)
+ZONE_VIEW_GETTER(paramPaths)
+ZONE_VIEW_GETTER(bargraphValues)
+ZONE_VIEW_GETTER(bargraphPaths)
+
+static PyGetSetDef getSets[] = {
+    {"paramValues", (getter)pyGet_paramValues, nullptr,
+     "Writable float32 memoryview of every parameter's value, in the order of "
+     "paramPaths. Writes are applied at the next block boundary.",
+     nullptr},
+    {"paramPaths", (getter)pyGet_paramPaths, nullptr,
+     "Tuple of the full path of each entry of paramValues.", nullptr},
+    {"bargraphValues", (getter)pyGet_bargraphValues, nullptr,
+     "Read-only float32 memoryview of every bargraph's value, in the order "
+     "of bargraphPaths. Updated once per cook.",
+     nullptr},
+    {"bargraphPaths", (getter)pyGet_bargraphPaths, nullptr,
+     "Tuple of the full path of each entry of bargraphValues.", nullptr},
+    {0}};
+
 static PyMethodDef methods[] = {
     {"panic", (PyCFunction)pyPanic, METH_VARARGS,
      "Sends a volume off event for each channel and note off event for each "
@@ -354,6 +645,24 @@ static PyMethodDef methods[] = {
      "channel. Valid ranges are 1 to 16. index - The MIDI controller index. "
      "Valid ranges are 0 to 127. value - The MIDI control value. Valid ranges "
      "are 0 to 127."},
+    {"renderBatch", (PyCFunction)pyRenderBatch, METH_VARARGS,
+     "Renders the compiled DSP offline once for each row of a parameter "
+     "matrix, in parallel. param_matrix - One row per render, one column per "
+     "entry of paramPaths. num_samples - Length of each render. input - "
+     "Optional input signal, one row per DSP input, shared by all renders. "
+     "Returns a float32 array of shape (rows, outputs, num_samples)."},
+    {"sendEvents", (PyCFunction)pySendEvents, METH_VARARGS,
+     "Sends a batch of MIDI events, dispatched at sample offsets within the "
+     "next cook. events - A list of (type, channel, data1, data2, "
+     "sample_offset) tuples, or an integer array of them with one event per "
+     "row. The sample offset may be left out. type - 0 note on, 1 note off, "
+     "2 control, 3 pitch bend, 4 program, 5 key pressure, 6 channel "
+     "pressure."},
+    {"dumpTrace", (PyCFunction)pyDumpTrace, METH_VARARGS,
+     "Writes the events recorded by every Faust CHOP with Trace on to a "
+     "Chrome trace JSON file, for ui.perfetto.dev or chrome://tracing. "
+     "path - Optional, the Trace File parameter by default. Returns the path "
+     "written."},
     {0}};
 
 // These functions are basic C function, which the DLL loader can find
@@ -385,7 +694,7 @@ void FillCHOPPluginInfo(CHOP_PluginInfo* info) {
 
   info->customOPInfo.pythonVersion->setString(PY_VERSION);
   info->customOPInfo.pythonMethods = methods;
-  // info->customOPInfo.pythonGetSets = getSets; // todo:
+  info->customOPInfo.pythonGetSets = getSets;
 }
 
 DLLEXPORT
@@ -412,6 +721,7 @@ FaustCHOP::FaustCHOP(const OP_NodeInfo* info) : m_NodeInfo(info) {
   m_poly_factory = NULL;
   m_dsp = NULL;
   m_dsp_poly = NULL;
+  m_poly_voices = NULL;
   m_ui = NULL;
   m_midi_ui = NULL;
   m_json_ui = NULL;
@@ -481,21 +791,22 @@ void FaustCHOP::clear() {
   m_numInputChannels = 0;
   m_numOutputChannels = 0;
 
-  // todo: do something with m_midi_handler
-  if (m_dsp_poly) {
-    m_midi_handler.removeMidiIn(m_dsp_poly);
-    m_midi_handler.stopMidi();
-  }
+  m_midi_handler.stopMidi();
+  m_midi_handler.removeMidiIn(&m_midiDevice);
+  m_midiDevice.setPassthrough(nullptr);
   if (m_midi_ui) {
     m_midi_ui->removeMidiIn(m_dsp_poly);
     m_midi_ui->stop();
   }
 
+  m_zoneViews.reset();
   SAFE_DELETE(m_dsp);
   SAFE_DELETE(m_ui);
   SAFE_DELETE(m_dsp_poly);
+  m_poly_voices = nullptr;
   SAFE_DELETE(m_midi_ui);
   SAFE_DELETE(m_json_ui);
+  m_prefetcher.clear();
   SAFE_DELETE(m_soundUI);
 
   // deleteAllDSPFactories();  // don't actually do this!!
@@ -507,15 +818,26 @@ void FaustCHOP::clear() {
 }
 
 void FaustCHOP::clearMIDI() {
-  for (int i = 0; i < 127; i++) {
-    m_midiBuffer[i] = 0;
-  }
+  m_midiInput.clear();
+  m_midiEvents.clear();
+  m_scriptEvents.clear();
+  m_midiDevice.clear();
 
   if (m_dsp_poly) {
     m_dsp_poly->instanceClear();
   }
 }
 
+void FaustCHOP::dispatchMidi(const FaustCHOPMidiEvent& event) {
+  if (m_dsp_poly) {
+    event.dispatch(m_dsp_poly);
+  }
+  // MIDI UI controls only follow device MIDI, as they always have.
+  if (event.device && m_midi_ui) {
+    event.dispatch(m_midi_ui);
+  }
+}
+
 void FaustCHOP::clearBufs() {
   if (m_input != NULL) {
     for (int i = 0; i < m_numInputChannels; i++) {
@@ -562,6 +884,8 @@ void FaustCHOP::allocate(int inputChannels, int outputChannels,
   return false;
 
 bool FaustCHOP::eval(const string& code) {
+  FaustCHOPTraceScope evalScope(m_traceNode, "eval");
+
   // clean up
   clear();
 
@@ -614,12 +938,15 @@ bool FaustCHOP::eval(const string& code) {
 #endif
 
   // create new factory
-  if (m_polyphony_enable) {
-    m_poly_factory = createPolyDSPFactoryFromString(
-        "TD", theCode, argc, argv, target.c_str(), m_errorString, optimize);
-  } else {
-    m_factory = createDSPFactoryFromString(
-        "TD", theCode, argc, argv, target.c_str(), m_errorString, optimize);
+  {
+    FaustCHOPTraceScope scope(m_traceNode, "createFactory");
+    if (m_polyphony_enable) {
+      m_poly_factory = createPolyDSPFactoryFromString(
+          "TD", theCode, argc, argv, target.c_str(), m_errorString, optimize);
+    } else {
+      m_factory = createDSPFactoryFromString(
+          "TD", theCode, argc, argv, target.c_str(), m_errorString, optimize);
+    }
   }
 
   if (argv) {
@@ -657,22 +984,23 @@ bool FaustCHOP::eval(const string& code) {
   }
 #endif
 
-  if (m_polyphony_enable) {
-    m_dsp_poly = m_poly_factory->createPolyDSPInstance(
-        m_nvoices, m_dynamicVoices, m_groupVoices);
-    if (!m_dsp_poly) {
-      std::cerr << "Cannot create Poly DSP instance." << std::endl;
-      FAUSTPROCESSOR_FAIL_COMPILE
-    }
-    if (m_midi_enable) {
-      m_midi_handler.addMidiIn(m_dsp_poly);
-    }
-  } else {
-    // create DSP instance
-    m_dsp = m_factory->createDSPInstance();
-    if (!m_dsp) {
-      std::cerr << "Cannot create DSP instance." << std::endl;
-      FAUSTPROCESSOR_FAIL_COMPILE
+  {
+    FaustCHOPTraceScope scope(m_traceNode, "createInstance");
+    if (m_polyphony_enable) {
+      m_dsp_poly = createFaustCHOPPolyInstance(m_poly_factory, m_nvoices,
+                                               m_dynamicVoices, m_groupVoices,
+                                               &m_poly_voices);
+      if (!m_dsp_poly) {
+        std::cerr << "Cannot create Poly DSP instance." << std::endl;
+        FAUSTPROCESSOR_FAIL_COMPILE
+      }
+    } else {
+      // create DSP instance
+      m_dsp = m_factory->createDSPInstance();
+      if (!m_dsp) {
+        std::cerr << "Cannot create DSP instance." << std::endl;
+        FAUSTPROCESSOR_FAIL_COMPILE
+      }
     }
   }
 
@@ -680,17 +1008,33 @@ bool FaustCHOP::eval(const string& code) {
 
   // make new UI
   if (m_midi_enable) {
+    // Device MIDI goes through m_midiDevice, which timestamps it and hands
+    // it to the voices and to the MIDI UI during the cook.
+    m_midi_handler.addMidiIn(&m_midiDevice);
     m_midi_ui = new MidiUI(&m_midi_handler);
+    m_midi_handler.removeMidiIn(m_midi_ui);
+    m_midiDevice.setPassthrough(m_midi_ui);
     theDsp->buildUserInterface(m_midi_ui);
   }
 
   // build ui
-  m_ui = new FaustCHOPUI();
-  theDsp->buildUserInterface(m_ui);
+  {
+    FaustCHOPTraceScope scope(m_traceNode, "buildUserInterface");
+    m_ui = new FaustCHOPUI();
+    theDsp->buildUserInterface(m_ui);
+    FaustCHOPZoneViews::Zones params, bargraphs;
+    m_ui->getZones(false, params.paths, params.zones);
+    m_ui->getZones(true, bargraphs.paths, bargraphs.zones);
+    m_zoneViews.build(params, bargraphs);
+  }
 
   // build sound ui
-  if (strcmp(m_assetsDirPath, "") != 0) {
-    m_soundUI = new SoundUI(m_assetsDirPath, m_srate);
+  if (!m_assetsDirPath.empty()) {
+    FaustCHOPTraceScope scope(m_traceNode, "loadSoundfiles");
+    m_soundUI = new FaustCHOPSoundUI(
+        m_assetsDirPath, (int)(m_srate + .5),
+        m_loadSoundfilesAsync ? &m_loaderPool : nullptr, m_stream,
+        &m_prefetcher);
     theDsp->buildUserInterface(m_soundUI);
   }
 
@@ -705,12 +1049,15 @@ bool FaustCHOP::eval(const string& code) {
   m_json_ui = new JSONUI(m_name_app, "", inputs, outputs);
   theDsp->buildUserInterface(m_json_ui);
 
-  std::filesystem::create_directory("./dsp_output");
-  ofstream myfile;
-  myfile.open("dsp_output/" + m_name_app + ".json");
-  myfile.seekp(0, ios::beg);
-  myfile << m_json_ui->JSON(false);
-  myfile.close();
+  {
+    FaustCHOPTraceScope scope(m_traceNode, "writeJSON");
+    std::filesystem::create_directory("./dsp_output");
+    ofstream myfile;
+    myfile.open("dsp_output/" + m_name_app + ".json");
+    myfile.seekp(0, ios::beg);
+    myfile << m_json_ui->JSON(false);
+    myfile.close();
+  }
 
   // see if we need to alloc
   if (inputs != m_numInputChannels || outputs != m_numOutputChannels) {
@@ -719,7 +1066,10 @@ bool FaustCHOP::eval(const string& code) {
   }
 
   // init
-  theDsp->init((int)(m_srate + .5));
+  {
+    FaustCHOPTraceScope scope(m_traceNode, "init");
+    theDsp->init((int)(m_srate + .5));
+  }
 
   if (m_midi_enable) {
     m_midi_ui->run();
@@ -776,6 +1126,23 @@ string FaustCHOP::code() { return m_code; }
 
 void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
                         void* reserved) {
+  // The timeslice being rendered ends now.
+  const FaustCHOPMidiDevice::Clock::time_point cookTime =
+      FaustCHOPMidiDevice::Clock::now();
+
+  if (inputs->getParInt("Trace")) {
+    // The path changes when the node is renamed or moved.
+    if (!m_traceNode || strcmp(m_traceNode, m_NodeInfo->opPath) != 0) {
+      m_traceNode = FaustCHOPTrace::instance().intern(m_NodeInfo->opPath);
+    }
+  } else {
+    m_traceNode = nullptr;
+  }
+  m_traceFile = inputs->getParFilePath("Tracefile");
+  // Named after the node, so each CHOP's cooks stand out on the timeline
+  FaustCHOPTraceScope executeScope(m_traceNode, m_traceNode, "samples",
+                                   output->numSamples);
+
   m_ExecuteCount++;
   m_warningString = std::string("");
 
@@ -804,11 +1171,51 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
 
   inputs->enablePar("Midiinvirtual", midiinvirtualEnabled);
   inputs->enablePar("Midiinvirtualname", midiinvirtualEnabled);
+  inputs->enablePar("Midilatency", inputs->getParInt("Midi"));
+
+#if __linux__
+  bool perfcountersEnabled = true;
+#else
+  bool perfcountersEnabled = false;
+#endif
 
+  inputs->enablePar("Perfcounters", perfcountersEnabled);
+  m_perf.setEnabled(perfcountersEnabled && inputs->getParInt("Perfcounters"));
+  if (!m_perf.error().empty()) {
+    m_warningString = m_perf.error();
+  }
+
+  bool streamEnable = inputs->getParInt("Streamsoundfiles");
+  inputs->enablePar("Streampreload", streamEnable);
+  inputs->enablePar("Streamcachepath",
+                    streamEnable || inputs->getParInt("Resamplesoundfiles"));
+  inputs->enablePar("Streamcachesize",
+                    streamEnable || inputs->getParInt("Resamplesoundfiles"));
+
+  // The cache is shared by every Faust CHOP in the process, so the size is
+  // only applied when it is changed on this one: the last change wins.
+  const double soundCacheSize = inputs->getParDouble("Soundcachesize");
+  if (soundCacheSize != m_soundCacheSize) {
+    m_soundCacheSize = soundCacheSize;
+    FaustCHOPSoundfileCache::instance().setCapacity(
+        (size_t)(soundCacheSize * 1024. * 1024.));
+  }
+
+  // A cook that compiles isn't counted in the cook statistics.
+  const bool compiling = m_wantCompile;
   if (m_wantCompile) {
     // update all variables that are necessary before compiling
     m_faustLibrariesPath = inputs->getParFilePath("Faustlibrariespath");
     m_assetsDirPath = inputs->getParFilePath("Assetspath");
+    m_loadSoundfilesAsync = inputs->getParInt("Loadinbackground");
+    m_stream.enabled = inputs->getParInt("Streamsoundfiles");
+    m_stream.cacheDir = inputs->getParFilePath("Streamcachepath");
+    m_stream.cacheBytes = (uint64_t)(inputs->getParDouble("Streamcachesize") *
+                                     1024. * 1024. * 1024.);
+    m_stream.preloadFrames =
+        (int)(inputs->getParDouble("Streampreload") * m_srate / 1000.);
+    m_stream.sampleRate =
+        inputs->getParInt("Resamplesoundfiles") ? (int)m_srate : 0;
 
     m_polyphony_enable = polyEnable;
     m_nvoices = inputs->getParInt("Nvoices");
@@ -840,16 +1247,14 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
   const OP_CHOPInput* midiInput = inputs->getInputCHOP(2);
 
   // A reasonably large block size. Code farther below will make it smaller when
-  // polyphony is necessary, or the control signals are high audio rate.
+  // the control signals are high audio rate. MIDI doesn't shrink it: blocks
+  // are split at the MIDI events instead.
   m_blockSize = 1024;
 
   if (controlInput && controlInput->numChannels) {
     m_blockSize =
         std::min(m_blockSize, (int)(m_srate / controlInput->sampleRate));
   }
-  if (midiInput && midiInput->numChannels) {
-    m_blockSize = std::min(m_blockSize, (int)(m_srate / midiInput->sampleRate));
-  }
   m_blockSize = std::max(m_blockSize, 1);
 
   if (m_blockSize > m_allocatedSamples) {
@@ -884,9 +1289,40 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
     return;
   }
 
-  int pitch = 0;
-  int pastVel = 0;
-  int velo = 0;
+  if (m_soundUI) {
+    m_soundUI->swapLoaded();
+  }
+
+  {
+    FaustCHOPTraceScope scope(m_traceNode, "collectMidi", "events");
+    m_midiEvents.clear();
+    if (midiInput && m_polyphony_enable && m_dsp_poly) {
+      m_midiInput.diff(midiInput, output->numSamples, m_midiEvents);
+    }
+    if (m_midi_enable) {
+      m_midiDevice.schedule(cookTime, m_srate, output->numSamples,
+                            inputs->getParDouble("Midilatency") / 1000.,
+                            m_midiEvents);
+    }
+    if (!m_scriptEvents.empty()) {
+      // Events past this cook wait for a later one.
+      size_t kept = 0;
+      for (FaustCHOPMidiEvent& event : m_scriptEvents) {
+        if (event.offset < output->numSamples) {
+          event.offset = std::max(event.offset, 0);
+          m_midiEvents.push_back(event);
+        } else {
+          event.offset -= output->numSamples;
+          m_scriptEvents[kept++] = event;
+        }
+      }
+      m_scriptEvents.resize(kept);
+    }
+    std::stable_sort(m_midiEvents.begin(), m_midiEvents.end());
+    m_numMidiEvents = (int)m_midiEvents.size();
+    scope.setArg(m_numMidiEvents);
+  }
+  size_t nextMidiEvent = 0;
 
   int numSamples = 0;
   float* writePtr = nullptr;
@@ -894,20 +1330,23 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
   bool needGuiMutex = m_nvoices > 0 && m_polyphony_enable && m_groupVoices;
 
   int controlSample = 0;
-  int midiSample = 0;
 
   double controlToOutputSampleRatio =
       controlInput
           ? (double)controlInput->numSamples / (double)output->numSamples
           : 0.;
 
-  double midiToOutputSampleRatio =
-      midiInput ? (double)midiInput->numSamples / (double)output->numSamples
-                : 0.;
-
   int chan = 0;
 
-  for (int i = 0; i < output->numSamples; i += m_blockSize) {
+  // Page faults taken while computing mean a streamed soundfile wasn't in
+  // memory in time.
+  const bool streaming = m_stream.enabled && m_soundUI;
+  const int64_t faultsBefore = streaming ? FaustCHOPStream::majorFaults() : -1;
+
+  // Time spent in compute() during this cook
+  std::chrono::steady_clock::duration computeTime{0};
+
+  for (int i = 0; i < output->numSamples; i += numSamples) {
     if (controlInput) {
       controlSample = int(controlToOutputSampleRatio * i);
 
@@ -923,6 +1362,7 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
         // Therefore we have to call updateAllGuis to update all dependent
         // parameters.
         if (needGuiMutex) {
+          FaustCHOPTraceScope scope(m_traceNode, "updateAllGuis");
           if (m_guiUpdateMutex.Lock()) {
             // Have Faust update all GUIs.
             GUI::updateAllGuis();
@@ -933,29 +1373,31 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
       }
     }
 
-    numSamples = min(output->numSamples - i, m_blockSize);
-
-    if (midiInput && m_polyphony_enable && m_dsp_poly) {
-      midiSample = int(midiToOutputSampleRatio * i);
-
-      if (midiSample < midiInput->numSamples) {
-        for (pitch = 0; pitch < std::min(127, midiInput->numChannels);
-             pitch++) {
-          velo = int(127 * midiInput->getChannelData(pitch)[midiSample]);
-
-          pastVel = m_midiBuffer[pitch];
+    // Values written to paramValues from Python since the last block.
+    if (m_zoneViews.syncParams() && needGuiMutex) {
+      FaustCHOPTraceScope scope(m_traceNode, "updateAllGuis");
+      if (m_guiUpdateMutex.Lock()) {
+        GUI::updateAllGuis();
+        m_guiUpdateMutex.Unlock();
+      }
+    }
 
-          if (pastVel != velo) {
-            if (velo > 0 && pastVel <= 0) {
-              m_dsp_poly->keyOn(0, pitch, velo);
-            } else if (velo <= 0 && pastVel > 0) {
-              m_dsp_poly->keyOff(0, pitch, velo);
-            }
+    numSamples = min(output->numSamples - i, m_blockSize);
 
-            m_midiBuffer[pitch] = velo;
-          }
-        }
+    // Dispatch the MIDI events that are due, then end this block where the
+    // next one starts so that it lands on its sample.
+    if (nextMidiEvent < m_midiEvents.size() &&
+        m_midiEvents[nextMidiEvent].offset <= i) {
+      FaustCHOPTraceScope scope(m_traceNode, "dispatchMidi", "events");
+      const size_t firstMidiEvent = nextMidiEvent;
+      while (nextMidiEvent < m_midiEvents.size() &&
+             m_midiEvents[nextMidiEvent].offset <= i) {
+        dispatchMidi(m_midiEvents[nextMidiEvent++]);
       }
+      scope.setArg((int64_t)(nextMidiEvent - firstMidiEvent));
+    }
+    if (nextMidiEvent < m_midiEvents.size()) {
+      numSamples = min(numSamples, m_midiEvents[nextMidiEvent].offset - i);
     }
 
     if (audioInput) {
@@ -976,12 +1418,15 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
       memset(writePtr, 0, numSamples * sizeof(float));
     }
 
-    // auto start = high_resolution_clock::now();
-
-    theDsp->compute(numSamples, m_input, m_output);
-
-    // auto stop = high_resolution_clock::now();
-    // myDuration = duration_cast<microseconds>(stop - start);
+    {
+      FaustCHOPTraceScope scope(m_traceNode, "compute", "samples",
+                                numSamples);
+      m_perf.begin();
+      const auto computeStart = std::chrono::steady_clock::now();
+      theDsp->compute(numSamples, m_input, m_output);
+      computeTime += std::chrono::steady_clock::now() - computeStart;
+      m_perf.end(numSamples);
+    }
 
     for (chan = 0; chan < output->numChannels; chan++) {
       writePtr = output->channels[chan];
@@ -990,15 +1435,65 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
     }
   }
 
+  if (streaming) {
+    updateStreamStats(faultsBefore);
+  }
+  if (m_zoneViews.isActive()) {
+    FaustCHOPTraceScope scope(m_traceNode, "syncBargraphs");
+    m_zoneViews.syncBargraphs();
+  }
+
+  if (!compiling) {
+    m_cookStats.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            FaustCHOPMidiDevice::Clock::now() - cookTime)
+            .count(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(computeTime)
+            .count(),
+        output->numSamples, m_srate);
+  }
+
   m_errorString = std::string("");
 }
 
+void FaustCHOP::updateStreamStats(int64_t faultsBefore) {
+  const int64_t faults = FaustCHOPStream::majorFaults();
+  if (faultsBefore >= 0 && faults > faultsBefore) {
+    m_streamUnderruns += faults - faultsBefore;
+  }
+
+  const uint64_t unlocked = FaustCHOPStream::getUnlockedBytes();
+  if (unlocked && m_warningString.empty()) {
+    m_warningString =
+        to_string((unlocked + (1 << 20) - 1) >> 20) +
+        " MB of soundfile heads couldn't be locked in memory (see the "
+        "system's limit on locked memory) and may underrun.";
+  }
+
+  // Disk throughput, averaged over half a second.
+  const auto now = std::chrono::steady_clock::now();
+  const double elapsed =
+      std::chrono::duration<double>(now - m_streamReadTime).count();
+  if (m_streamReadBytes < 0 || elapsed >= .5) {
+    const int64_t bytes = FaustCHOPStream::diskReadBytes();
+    if (m_streamReadBytes >= 0 && bytes >= m_streamReadBytes) {
+      m_streamReadRate =
+          (float)((bytes - m_streamReadBytes) / elapsed / (1024. * 1024.));
+    }
+    m_streamReadBytes = bytes;
+    m_streamReadTime = now;
+  }
+}
+
 int32_t FaustCHOP::getNumInfoCHOPChans(void* reserved1) {
   // We return the number of channel we want to output to any Info CHOP
   // connected to the CHOP. In this example we are just going to send one
   // channel.
 
-  int numChans = 3;
+  int numChans = 25;
+
+  // The percentiles are computed once per cook, not once per channel.
+  m_cookSummary = m_cookStats.summarize();
 
   if (m_ui) {
     numChans += m_ui->getNumBarGraphs();
@@ -1016,18 +1511,81 @@ void FaustCHOP::getInfoCHOPChan(int32_t index, OP_InfoCHOPChan* chan,
     chan->name->setString("executeCount");
     chan->value = (float)m_ExecuteCount;
   }
-  // else if (index == 1) {
-  //	chan->name->setString("faustDSPCookTime");
-  //	chan->value = myDuration.count() / 1000.;
-  //}
   else if (index == 1) {
     chan->name->setString("inputs");
     chan->value = m_numInputChannels;
   } else if (index == 2) {
     chan->name->setString("block_size");
     chan->value = m_blockSize;
+  } else if (index == 3) {
+    chan->name->setString("midi_events");
+    chan->value = m_numMidiEvents;
+  } else if (index == 4) {
+    chan->name->setString("midi_jitter_quantized_ms");
+    chan->value = (float)m_midiDevice.getQuantizedJitter();
+  } else if (index == 5) {
+    chan->name->setString("midi_late");
+    chan->value = (float)m_midiDevice.getNumLate();
+  } else if (index == 6) {
+    chan->name->setString("midi_dropped");
+    chan->value = (float)m_midiDevice.getNumDropped();
+  } else if (index == 7) {
+    chan->name->setString("soundcache_mb");
+    chan->value =
+        FaustCHOPSoundfileCache::instance().getBytes() / (1024.f * 1024.f);
+  } else if (index == 8) {
+    chan->name->setString("soundcache_hits");
+    chan->value = (float)FaustCHOPSoundfileCache::instance().getHits();
+  } else if (index == 9) {
+    chan->name->setString("soundcache_misses");
+    chan->value = (float)FaustCHOPSoundfileCache::instance().getMisses();
+  } else if (index == 10) {
+    chan->name->setString("soundfiles_pending");
+    chan->value = m_soundUI ? m_soundUI->getNumPending() : 0;
+  } else if (index == 11) {
+    chan->name->setString("soundfiles_loaded");
+    chan->value = m_soundUI ? m_soundUI->getNumLoaded() : 0;
+  } else if (index == 12) {
+    chan->name->setString("soundfiles_total");
+    chan->value = m_soundUI ? m_soundUI->getNumTotal() : 0;
+  } else if (index == 13) {
+    chan->name->setString("stream_underruns");
+    chan->value = (float)m_streamUnderruns;
+  } else if (index == 14) {
+    chan->name->setString("stream_disk_mb_s");
+    chan->value = m_streamReadRate;
+  } else if (index == 15) {
+    chan->name->setString("stream_unlocked_mb");
+    chan->value = FaustCHOPStream::getUnlockedBytes() / (1024.f * 1024.f);
+  } else if (index == 16) {
+    chan->name->setString("cook_p50_us");
+    chan->value = m_cookSummary.cookP50Us;
+  } else if (index == 17) {
+    chan->name->setString("cook_p99_us");
+    chan->value = m_cookSummary.cookP99Us;
+  } else if (index == 18) {
+    chan->name->setString("cook_max_us");
+    chan->value = m_cookSummary.cookMaxUs;
+  } else if (index == 19) {
+    chan->name->setString("compute_p50_us");
+    chan->value = m_cookSummary.computeP50Us;
+  } else if (index == 20) {
+    chan->name->setString("compute_p99_us");
+    chan->value = m_cookSummary.computeP99Us;
+  } else if (index == 21) {
+    chan->name->setString("compute_max_us");
+    chan->value = m_cookSummary.computeMaxUs;
+  } else if (index == 22) {
+    chan->name->setString("dsp_load_p50");
+    chan->value = m_cookSummary.loadP50;
+  } else if (index == 23) {
+    chan->name->setString("dsp_load_p99");
+    chan->value = m_cookSummary.loadP99;
+  } else if (index == 24) {
+    chan->name->setString("dsp_load_max");
+    chan->value = m_cookSummary.loadMax;
   } else {
-    index -= 3;
+    index -= 25;
 
     chan->name->setString(
         ("bargraph_" + m_ui->getNthBarGraphAddress(index)).c_str());
@@ -1036,7 +1594,11 @@ void FaustCHOP::getInfoCHOPChan(int32_t index, OP_InfoCHOPChan* chan,
 }
 
 bool FaustCHOP::getInfoDATSize(OP_InfoDATSize* infoSize, void* reserved1) {
-  infoSize->rows = 2;
+  // The counters are read once per cook, not once per row.
+  m_perfInfo.clear();
+  m_perf.describe(m_perfInfo);
+
+  infoSize->rows = 2 + (int32_t)m_perfInfo.size();
   infoSize->cols = 2;
   // Setting this to false means we'll be assigning values to the table
   // one row at a time. True means we'll do it one column at a time.
@@ -1068,6 +1630,11 @@ void FaustCHOP::getInfoDATEntries(int32_t index, int32_t nEntries,
     // Set the value for the second column
     entries->values[1]->setString(m_name_app.c_str());
   }
+
+  else if (index - 2 < (int32_t)m_perfInfo.size()) {
+    entries->values[0]->setString(m_perfInfo[index - 2].first.c_str());
+    entries->values[1]->setString(m_perfInfo[index - 2].second.c_str());
+  }
 }
 
 void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
@@ -1174,6 +1741,22 @@ void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
     assert(res == OP_ParAppendResult::Success);
   }
 
+  // MIDI latency
+  {
+    OP_NumericParameter np;
+
+    np.name = "Midilatency";
+    np.label = "MIDI Latency (ms)";
+    np.defaultValues[0] = 20.;
+    np.minSliders[0] = 0.;
+    np.maxSliders[0] = 100.;
+    np.minValues[0] = 0.;
+    np.clampMins[0] = true;
+
+    OP_ParAppendResult res = manager->appendFloat(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
   // Faust source code DAT
   {
     OP_StringParameter sp;
@@ -1211,6 +1794,101 @@ void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
     assert(res == OP_ParAppendResult::Success);
   }
 
+  // Load soundfiles in background
+  {
+    OP_NumericParameter np;
+
+    np.name = "Loadinbackground";
+    np.label = "Load Soundfiles in Background";
+    np.defaultValues[0] = true;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Resample soundfiles to the CHOP's sample rate
+  {
+    OP_NumericParameter np;
+
+    np.name = "Resamplesoundfiles";
+    np.label = "Resample Soundfiles";
+    np.defaultValues[0] = false;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Stream soundfiles from disk
+  {
+    OP_NumericParameter np;
+
+    np.name = "Streamsoundfiles";
+    np.label = "Stream Soundfiles";
+    np.defaultValues[0] = false;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Stream preload
+  {
+    OP_NumericParameter np;
+
+    np.name = "Streampreload";
+    np.label = "Stream Preload (ms)";
+    np.defaultValues[0] = 250.;
+    np.minSliders[0] = 0.;
+    np.maxSliders[0] = 2000.;
+    np.minValues[0] = 0.;
+    np.clampMins[0] = true;
+
+    OP_ParAppendResult res = manager->appendFloat(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Folder for streamed and resampled soundfiles
+  {
+    OP_StringParameter sp;
+
+    sp.name = "Streamcachepath";
+    sp.label = "Soundfile Cache Path";
+
+    OP_ParAppendResult res = manager->appendFolder(sp);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Disk budget of the folder above
+  {
+    OP_NumericParameter np;
+
+    np.name = "Streamcachesize";
+    np.label = "Soundfile Cache Size (GB)";
+    np.defaultValues[0] = 0.;
+    np.minSliders[0] = 0.;
+    np.maxSliders[0] = 500.;
+    np.minValues[0] = 0.;
+    np.clampMins[0] = true;
+
+    OP_ParAppendResult res = manager->appendFloat(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Sound cache size, shared by all Faust CHOPs
+  {
+    OP_NumericParameter np;
+
+    np.name = "Soundcachesize";
+    np.label = "Sound Cache Size (MB)";
+    np.defaultValues[0] = 2048.;
+    np.minSliders[0] = 0.;
+    np.maxSliders[0] = 16384.;
+    np.minValues[0] = 0.;
+    np.clampMins[0] = true;
+
+    OP_ParAppendResult res = manager->appendFloat(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
   // Options
   {
     OP_StringParameter sp;
@@ -1257,6 +1935,64 @@ void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
     assert(res == OP_ParAppendResult::Success);
   }
 
+  // Reset Stats
+  {
+    OP_NumericParameter np;
+
+    np.name = "Resetstats";
+    np.label = "Reset Stats";
+
+    OP_ParAppendResult res = manager->appendPulse(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Record a trace of the cooks
+  {
+    OP_NumericParameter np;
+
+    np.name = "Trace";
+    np.label = "Trace";
+    np.defaultValues[0] = false;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Trace file
+  {
+    OP_StringParameter sp;
+
+    sp.name = "Tracefile";
+    sp.label = "Trace File";
+    sp.defaultValue = "trace.json";
+
+    OP_ParAppendResult res = manager->appendFile(sp);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Dump Trace
+  {
+    OP_NumericParameter np;
+
+    np.name = "Dumptrace";
+    np.label = "Dump Trace";
+
+    OP_ParAppendResult res = manager->appendPulse(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Hardware performance counters (Linux only)
+  {
+    OP_NumericParameter np;
+
+    np.name = "Perfcounters";
+    np.label = "Perf Counters";
+    np.defaultValues[0] = false;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
   //// menu parameter example
   //{
   //	OP_StringParameter	sp;
@@ -1286,6 +2022,20 @@ void FaustCHOP::pulsePressed(const char* name, void* reserved1) {
   if (!strcmp(name, "Clearmidi")) {
     clearMIDI();
   }
+
+  if (!strcmp(name, "Resetstats")) {
+    m_cookStats.requestReset();
+    m_perf.requestReset();
+  }
+
+  if (!strcmp(name, "Dumptrace")) {
+    std::string path, error;
+    if (dumpTrace(path, error)) {
+      cerr << "[Faust]: Wrote trace to " << path << endl;
+    } else {
+      cerr << "[Faust]: " << error << endl;
+    }
+  }
 }
 
 void FaustCHOP::sendNoteOff(int channel, int note, int velocity) {
@@ -1327,3 +2077,36 @@ void FaustCHOP::sendControl(int channel, int ctrl, int value) {
     m_dsp_poly->ctrlChange(channel, ctrl, value);
   }
 }
+
+FaustCHOPBatchRenderer* FaustCHOP::createBatchRenderer(int numRows,
+                                                       std::string& error) {
+  if (m_polyphony_enable || !m_factory) {
+    error = m_polyphony_enable
+                ? "renderBatch needs a DSP compiled with Polyphony off"
+                : "renderBatch needs a compiled DSP";
+    return nullptr;
+  }
+  const int numThreads = (int)std::max(
+      1u, std::min((unsigned)std::max(numRows, 1),
+                   std::thread::hardware_concurrency()));
+  auto renderer = new FaustCHOPBatchRenderer(m_factory, (int)(m_srate + .5),
+                                             numThreads, m_assetsDirPath,
+                                             m_stream);
+  if (!renderer->isValid()) {
+    delete renderer;
+    error = "Cannot create DSP instance.";
+    return nullptr;
+  }
+  return renderer;
+}
+
+bool FaustCHOP::dumpTrace(std::string& path, std::string& error) {
+  if (path.empty()) {
+    path = m_traceFile.empty() ? "trace.json" : m_traceFile;
+  }
+  return FaustCHOPTrace::instance().dump(path, error);
+}
+
+void FaustCHOP::sendEvents(const std::vector<FaustCHOPMidiEvent>& events) {
+  m_scriptEvents.insert(m_scriptEvents.end(), events.begin(), events.end());
+}
@@ -44,6 +44,12 @@ using namespace TD;
 #include "TMutex.h"
 #include <faust/midi/rt-midi.h>
 
+#include "faustchop_midi.h"
+#include "faustchop_perf.h"
+#include "faustchop_poly.h"
+#include "faustchop_soundfiles.h"
+#include "faustchop_stats.h"
+#include "faustchop_trace.h"
 #include "faustchop_ui.cpp"
 
 #ifndef FAUSTFLOAT
@@ -61,6 +67,10 @@ using namespace TD;
 #include <structmember.h>
 #include <unicodeobject.h>
 
+#include "faustchop_python.h"
+
+class FaustCHOPBatchRenderer;
+
 // To get more help about these functions, look at CHOP_CPlusPlusBase.h
 class FaustCHOP : public CHOP_CPlusPlusBase {
  public:
@@ -95,6 +105,8 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
 
   void clear();
   void clearMIDI();
+  void dispatchMidi(const FaustCHOPMidiEvent& event);
+  void updateStreamStats(int64_t faultsBefore);
   void clearBufs();
   void allocate(int inputChannels, int outputChannels, int numSamples);
   bool eval(const string& code);
@@ -111,6 +123,13 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
   void sendPitchBend(int channel, int wheel);
   void sendProgram(int channel, int value);
   void sendControl(int channel, int ctrl, int value);
+  void sendEvents(const std::vector<FaustCHOPMidiEvent>& events);
+  FaustCHOPZoneViews& getZoneViews() { return m_zoneViews; }
+  // nullptr (with `error` set) if there is no non-polyphonic DSP compiled
+  FaustCHOPBatchRenderer* createBatchRenderer(int numRows, std::string& error);
+  // Writes the trace of every Faust CHOP to `path`, or to the Trace File
+  // parameter if it is empty.
+  bool dumpTrace(std::string& path, std::string& error);
 
  private:
   // We don't need to store this pointer, but we do for the example.
@@ -130,13 +149,26 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
   // code text (pre any modifications)
   string m_code;
   const char* m_faustLibrariesPath;
-  const char* m_assetsDirPath;
+  // A copy: the parameter's string only lives for the cook that compiles.
+  string m_assetsDirPath;
+  bool m_loadSoundfilesAsync = true;
+  // Sound Cache Size as this CHOP last applied it to the shared cache, in
+  // MB. Starts at the cache's own default.
+  double m_soundCacheSize = 2048.;
+  FaustCHOPStream::Settings m_stream;
+  // streaming diagnostics
+  int64_t m_streamUnderruns = 0;
+  float m_streamReadRate = 0.f;  // MB/s
+  int64_t m_streamReadBytes = -1;
+  std::chrono::steady_clock::time_point m_streamReadTime;
   // llvm factory
   llvm_dsp_factory* m_factory = nullptr;
   llvm_dsp_poly_factory* m_poly_factory = nullptr;
   // faust DSP object
   dsp* m_dsp = nullptr;
   dsp_poly* m_dsp_poly = nullptr;
+  // the voices inside m_dsp_poly (owned by it)
+  FaustCHOPPoly* m_poly_voices = nullptr;
   // faust compiler error string
   string m_errorString = string("");
   string m_warningString = string("");
@@ -150,7 +182,15 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
   // buffers
   FAUSTFLOAT** m_input = nullptr;
   FAUSTFLOAT** m_output = nullptr;
-  int m_midiBuffer[127];  // store velocity for each pitch
+
+  // MIDI CHOP input, diffed once per cook into a list of events
+  FaustCHOPMidiInput m_midiInput;
+  std::vector<FaustCHOPMidiEvent> m_midiEvents;
+  // events from the Python sendEvents method, offsets relative to the next
+  // cook
+  std::vector<FaustCHOPMidiEvent> m_scriptEvents;
+  // hardware MIDI, timestamped on the driver thread
+  FaustCHOPMidiDevice m_midiDevice;
 
   // input and output
   int m_numInputChannels = 0;
@@ -168,12 +208,28 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
   MidiUI* m_midi_ui = nullptr;
   JSONUI* m_json_ui = nullptr;
   FaustCHOPUI* m_ui = nullptr;
-  SoundUI* m_soundUI = nullptr;
+  FaustCHOPSoundUI* m_soundUI = nullptr;
+  // parameter and bargraph values for Python
+  FaustCHOPZoneViews m_zoneViews;
+  FaustCHOPLoaderPool m_loaderPool;
+  FaustCHOPPrefetcher m_prefetcher;
 
   bool m_wantCompile = false;
   bool m_wantReset = false;
-  // microseconds myDuration;
+
+  // cook and compute() times, and their summary for the Info CHOP
+  FaustCHOPCookStats m_cookStats;
+  FaustCHOPCookStats::Summary m_cookSummary;
+
+  // hardware counters around compute(), and their rows for the Info DAT
+  FaustCHOPPerfCounters m_perf;
+  std::vector<std::pair<std::string, std::string>> m_perfInfo;
+
+  // interned path of this node while tracing is on, nullptr otherwise
+  const char* m_traceNode = nullptr;
+  string m_traceFile = string("trace.json");
 
   // diagnostic vars:
   int m_blockSize = 0;
+  int m_numMidiEvents = 0;
 };
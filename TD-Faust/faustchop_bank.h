@@ -0,0 +1,410 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <faust/gui/Soundfile.h>
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPMappedFile
+// desc: A whole file mapped into memory, read-only or, when created with a
+//       size, read-write.
+//-----------------------------------------------------------------------------
+class FaustCHOPMappedFile {
+ public:
+  enum Advice { kSequential, kWillNeed };
+
+  FaustCHOPMappedFile() = default;
+  FaustCHOPMappedFile(const FaustCHOPMappedFile&) = delete;
+  FaustCHOPMappedFile& operator=(const FaustCHOPMappedFile&) = delete;
+  ~FaustCHOPMappedFile() { close(); }
+
+  bool open(const std::string& path) { return map(path, 0, false); }
+
+  // Create (or truncate) `path` with `size` bytes and map it for writing.
+  bool create(const std::string& path, uint64_t size) {
+    return map(path, size, true);
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (m_data) {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+      CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_data) {
+      munmap(m_data, (size_t)m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  // Hint how a byte range is going to be read. Failures are ignored.
+  void advise(uint64_t offset, uint64_t length, Advice advice) {
+    if (!m_data || offset >= m_size) {
+      return;
+    }
+    length = std::min(length, m_size - offset);
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+    if (advice == kWillNeed) {
+      WIN32_MEMORY_RANGE_ENTRY range;
+      range.VirtualAddress = m_data + offset;
+      range.NumberOfBytes = (SIZE_T)length;
+      PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#endif
+#else
+    // madvise wants a page-aligned start. Sequential access lets pages go
+    // early, so it doesn't spill onto the page before the range.
+    const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / page * page;
+    if (advice == kSequential && start < offset) {
+      start += page;
+      if (start >= offset + length) {
+        return;
+      }
+    }
+    madvise(m_data + start, (size_t)(length + offset - start),
+            advice == kWillNeed ? MADV_WILLNEED : MADV_SEQUENTIAL);
+#endif
+  }
+
+  // Keep a byte range in memory until the file is closed. Returns false if
+  // the OS refuses, for example past RLIMIT_MEMLOCK or the working set
+  // quota on Windows.
+  bool lock(uint64_t offset, uint64_t length) {
+    if (!m_data || offset >= m_size) {
+      return false;
+    }
+    length = std::min(length, m_size - offset);
+#ifdef _WIN32
+    return VirtualLock(m_data + offset, (SIZE_T)length) != 0;
+#else
+    const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    const uint64_t start = offset / page * page;
+    return mlock(m_data + start, (size_t)(length + offset - start)) == 0;
+#endif
+  }
+
+  char* data() const { return m_data; }
+  uint64_t size() const { return m_size; }
+
+ private:
+  bool map(const std::string& path, uint64_t size, bool write) {
+    close();
+#ifdef _WIN32
+    m_file = CreateFileA(path.c_str(), write ? GENERIC_READ | GENERIC_WRITE
+                                             : GENERIC_READ,
+                         FILE_SHARE_READ, nullptr,
+                         write ? CREATE_ALWAYS : OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (write) {
+      fileSize.QuadPart = (LONGLONG)size;
+      if (!SetFilePointerEx(m_file, fileSize, nullptr, FILE_BEGIN) ||
+          !SetEndOfFile(m_file)) {
+        close();
+        return false;
+      }
+    } else if (!GetFileSizeEx(m_file, &fileSize)) {
+      close();
+      return false;
+    }
+    m_size = (uint64_t)fileSize.QuadPart;
+    if (!m_size) {
+      close();
+      return false;
+    }
+    m_mapping = CreateFileMappingA(m_file, nullptr,
+                                   write ? PAGE_READWRITE : PAGE_READONLY, 0,
+                                   0, nullptr);
+    if (!m_mapping) {
+      close();
+      return false;
+    }
+    m_data = (char*)MapViewOfFile(m_mapping,
+                                  write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0,
+                                  0);
+#else
+    int fd = ::open(path.c_str(), write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY,
+                    0644);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (write) {
+      if (ftruncate(fd, (off_t)size) != 0) {
+        ::close(fd);
+        return false;
+      }
+      m_size = size;
+    } else if (fstat(fd, &st) == 0) {
+      m_size = (uint64_t)st.st_size;
+    }
+    void* data = m_size ? mmap(nullptr, (size_t)m_size,
+                               write ? PROT_READ | PROT_WRITE : PROT_READ,
+                               MAP_SHARED, fd, 0)
+                        : MAP_FAILED;
+    // The mapping keeps the file referenced.
+    ::close(fd);
+    m_data = data == MAP_FAILED ? nullptr : (char*)data;
+#endif
+    if (!m_data) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  char* m_data = nullptr;
+  uint64_t m_size = 0;
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+#endif
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPBank
+// desc: "FCSB" soundfile bank: the samples of a Faust soundfile, already in
+//       the DSP's float format and laid out the way Soundfile keeps them, so
+//       that a bank can be memory-mapped and played with no decoding.
+//
+// Layout:
+//   Header
+//   Part[parts]          length, sample rate and offset of each part
+//   char[keySize]        what the bank was made from (see FaustCHOPStream)
+//   padding up to dataOffset (a multiple of kAlignment)
+//   channel 0: sample[frames], channel 1: sample[frames], ...
+// The last BUFFER_SIZE frames of each channel are silence, used for the
+// empty parts up to MAX_SOUNDFILE_PARTS.
+//-----------------------------------------------------------------------------
+class FaustCHOPBank {
+ public:
+  static const uint32_t kVersion = 1;
+  static const uint64_t kAlignment = 65536;
+
+  struct Header {
+    char magic[4];  // "FCSB"
+    uint32_t version;
+    uint32_t sampleSize;  // sizeof(float) or sizeof(double)
+    uint32_t channels;
+    uint32_t parts;
+    uint32_t keySize;
+    uint64_t frames;  // per channel, including the trailing silence
+    uint64_t dataOffset;
+  };
+
+  struct Part {
+    int64_t offset;  // in frames
+    int32_t length;
+    int32_t sampleRate;
+  };
+
+  //---------------------------------------------------------------------------
+  // name: class FaustCHOPBank::Writer
+  // desc: Creates a bank file and maps it so samples can be written in place.
+  //---------------------------------------------------------------------------
+  class Writer {
+   public:
+    // `parts` only need their length and sample rate; offsets are assigned.
+    bool create(const std::string& path, uint32_t channels,
+                uint32_t sampleSize, std::vector<Part> parts,
+                const std::string& key) {
+      Header header;
+      memcpy(header.magic, "FCSB", 4);
+      header.version = kVersion;
+      header.sampleSize = sampleSize;
+      header.channels = std::max(1u, channels);
+      header.parts = (uint32_t)parts.size();
+      header.keySize = (uint32_t)key.size();
+
+      uint64_t frames = 0;
+      for (Part& part : parts) {
+        part.offset = (int64_t)frames;
+        frames += (uint64_t)part.length;
+      }
+      header.frames = frames + BUFFER_SIZE;
+      // Soundfile offsets are ints.
+      if (header.frames > (uint64_t)INT32_MAX) {
+        return false;
+      }
+
+      const uint64_t tableSize =
+          sizeof(Header) + parts.size() * sizeof(Part) + key.size();
+      header.dataOffset = (tableSize + kAlignment - 1) / kAlignment * kAlignment;
+
+      const uint64_t size =
+          header.dataOffset +
+          header.frames * header.channels * header.sampleSize;
+      if (!m_file.create(path, size)) {
+        return false;
+      }
+
+      char* p = m_file.data();
+      memcpy(p, &header, sizeof(Header));
+      memcpy(p + sizeof(Header), parts.data(), parts.size() * sizeof(Part));
+      memcpy(p + sizeof(Header) + parts.size() * sizeof(Part), key.data(),
+             key.size());
+      m_header = header;
+      m_parts = parts;
+      return true;
+    }
+
+    // Frames of part `part`, channel `channel`. The file starts zeroed.
+    void* samples(uint32_t channel, uint32_t part) {
+      return m_file.data() + m_header.dataOffset +
+             (channel * m_header.frames + (uint64_t)m_parts[part].offset) *
+                 m_header.sampleSize;
+    }
+
+    const Header& header() const { return m_header; }
+    void close() { m_file.close(); }
+
+   private:
+    FaustCHOPMappedFile m_file;
+    Header m_header;
+    std::vector<Part> m_parts;
+  };
+
+  // Map the bank at `path` and wrap it in a Soundfile whose buffers point
+  // into the mapping. Returns nullptr if the file isn't a bank, was made
+  // from something other than `key` (unless `key` is empty) or doesn't hold
+  // `isDouble` samples. The mapping lives as long as the Soundfile.
+  static std::shared_ptr<Soundfile> open(
+      const std::string& path, const std::string& key, bool isDouble,
+      std::shared_ptr<FaustCHOPMappedFile>* mapping = nullptr) {
+    auto file = std::make_shared<FaustCHOPMappedFile>();
+    if (!file->open(path) || file->size() < sizeof(Header)) {
+      return nullptr;
+    }
+
+    Header header;
+    memcpy(&header, file->data(), sizeof(Header));
+    const uint32_t sampleSize = isDouble ? sizeof(double) : sizeof(float);
+    if (memcmp(header.magic, "FCSB", 4) != 0 || header.version != kVersion ||
+        header.sampleSize != sampleSize || header.channels == 0 ||
+        header.channels > MAX_CHAN || header.parts == 0 ||
+        header.parts > MAX_SOUNDFILE_PARTS || header.frames < BUFFER_SIZE ||
+        header.frames > (uint64_t)INT32_MAX) {
+      return nullptr;
+    }
+    const uint64_t tableEnd =
+        sizeof(Header) + header.parts * sizeof(Part) + header.keySize;
+    if (tableEnd > header.dataOffset ||
+        header.dataOffset + header.frames * header.channels * sampleSize >
+            file->size()) {
+      return nullptr;
+    }
+    const char* storedKey =
+        file->data() + sizeof(Header) + header.parts * sizeof(Part);
+    if (!key.empty() && (header.keySize != key.size() ||
+                         memcmp(storedKey, key.data(), key.size()) != 0)) {
+      return nullptr;
+    }
+
+    std::vector<Part> parts(header.parts);
+    memcpy(parts.data(), file->data() + sizeof(Header),
+           header.parts * sizeof(Part));
+
+    // No channel buffers are allocated (and fChannels stays 0 so that
+    // ~Soundfile doesn't free them): they all point into the mapping.
+    Soundfile* soundfile =
+        new Soundfile(0, 0, MAX_CHAN, (int)header.parts, isDouble);
+    const int silence = (int)(header.frames - BUFFER_SIZE);
+    for (int part = 0; part < MAX_SOUNDFILE_PARTS; part++) {
+      if (part < (int)header.parts && parts[part].offset >= 0 &&
+          parts[part].length >= 0 &&
+          (uint64_t)(parts[part].offset + parts[part].length) <=
+              (uint64_t)silence) {
+        soundfile->fOffset[part] = (int)parts[part].offset;
+        soundfile->fLength[part] = parts[part].length;
+        soundfile->fSR[part] = parts[part].sampleRate;
+      } else {
+        soundfile->fOffset[part] = silence;
+        soundfile->fLength[part] = BUFFER_SIZE;
+        soundfile->fSR[part] = SAMPLE_RATE;
+      }
+    }
+
+    char* data = file->data() + header.dataOffset;
+    for (int chan = 0; chan < MAX_CHAN; chan++) {
+      char* channel = data + (chan % header.channels) * header.frames *
+                                 sampleSize;
+      if (isDouble) {
+        static_cast<double**>(soundfile->fBuffers)[chan] = (double*)channel;
+      } else {
+        static_cast<float**>(soundfile->fBuffers)[chan] = (float*)channel;
+      }
+    }
+
+    if (mapping) {
+      *mapping = file;
+    }
+    return std::shared_ptr<Soundfile>(
+        soundfile, [file](Soundfile* soundfile) { delete soundfile; });
+  }
+
+  // Like open(), but copies the samples into memory so that playing them
+  // never waits for the disk. The file is unmapped again before returning.
+  static std::shared_ptr<Soundfile> read(const std::string& path,
+                                         const std::string& key,
+                                         bool isDouble) {
+    std::shared_ptr<FaustCHOPMappedFile> mapping;
+    std::shared_ptr<Soundfile> mapped = open(path, key, isDouble, &mapping);
+    if (!mapped) {
+      return nullptr;
+    }
+    Header header;
+    memcpy(&header, mapping->data(), sizeof(Header));
+
+    Soundfile* soundfile = new Soundfile((int)header.channels,
+                                         (int)header.frames, MAX_CHAN,
+                                         mapped->fParts, isDouble);
+    for (int part = 0; part < MAX_SOUNDFILE_PARTS; part++) {
+      soundfile->fOffset[part] = mapped->fOffset[part];
+      soundfile->fLength[part] = mapped->fLength[part];
+      soundfile->fSR[part] = mapped->fSR[part];
+    }
+    const size_t bytes = (size_t)header.frames * header.sampleSize;
+    void** from = static_cast<void**>(mapped->fBuffers);
+    void** to = static_cast<void**>(soundfile->fBuffers);
+    for (int chan = 0; chan < MAX_CHAN; chan++) {
+      if (chan < (int)header.channels) {
+        memcpy(to[chan], from[chan], bytes);
+      } else {
+        to[chan] = to[chan % header.channels];
+      }
+    }
+    return std::shared_ptr<Soundfile>(soundfile);
+  }
+};
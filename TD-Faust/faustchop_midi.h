@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "CPlusPlus_Common.h"
+#include "faust/midi/midi.h"
+#include "faustchop_queue.h"
+
+//-----------------------------------------------------------------------------
+// name: struct FaustCHOPMidiEvent
+// desc: a MIDI message scheduled at a sample offset inside the current cook
+//-----------------------------------------------------------------------------
+struct FaustCHOPMidiEvent {
+  enum Type {
+    kNoteOn = 0,
+    kNoteOff,
+    kControl,
+    kPitchBend,
+    kProgram,
+    kKeyPressure,
+    kChannelPressure
+  };
+
+  int offset;  // sample offset relative to the start of the output timeslice
+  int type;
+  int channel;
+  int data1;
+  int data2;
+  bool device = false;  // came from a MIDI device rather than the MIDI CHOP
+
+  void dispatch(midi* target) const {
+    switch (type) {
+      case kNoteOn:
+        target->keyOn(channel, data1, data2);
+        break;
+      case kNoteOff:
+        target->keyOff(channel, data1, data2);
+        break;
+      case kControl:
+        target->ctrlChange(channel, data1, data2);
+        break;
+      case kPitchBend:
+        target->pitchWheel(channel, data1);
+        break;
+      case kProgram:
+        target->progChange(channel, data1);
+        break;
+      case kKeyPressure:
+        target->keyPress(channel, data1, data2);
+        break;
+      case kChannelPressure:
+        target->chanPress(channel, data1);
+        break;
+    }
+  }
+
+  bool operator<(const FaustCHOPMidiEvent& other) const {
+    return offset < other.offset;
+  }
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPMidiInput
+// desc: Diffs a MIDI CHOP against its state from the previous cook and turns
+//       the changes into a compact, time-ordered list of MIDI events.
+//
+// Channel names follow the MIDI In CHOP conventions, with an optional
+// "ch<N>" prefix selecting the MIDI channel (1-16):
+//   n60 / note60     note velocity (0-1)
+//   c7 / cc7         controller value (0-1)
+//   pb / pitchbend   pitch bend (-1 to 1)
+//   prog / program   program number (0-127, not normalized)
+// If none of the channel names match, the channel index is the note number,
+// which is how the third input of the Faust CHOP has always been read.
+//-----------------------------------------------------------------------------
+class FaustCHOPMidiInput {
+ public:
+  void clear() {
+    for (auto& route : m_routes) {
+      route.raw = 0.f;
+      route.value = route.kind == FaustCHOPMidiEvent::kPitchBend ? 8192 : 0;
+    }
+  }
+
+  // Append the events found in `input` to `events`, sorted by offset.
+  // `numOutputSamples` is the length of the timeslice the offsets refer to.
+  void diff(const TD::OP_CHOPInput* input, int numOutputSamples,
+            std::vector<FaustCHOPMidiEvent>& events) {
+    if (!input || input->numChannels <= 0 || input->numSamples <= 0) {
+      return;
+    }
+
+    updateRoutes(input);
+
+    const double outputPerInput =
+        (double)numOutputSamples / (double)input->numSamples;
+    const size_t firstNew = events.size();
+
+    for (size_t chan = 0; chan < m_routes.size(); chan++) {
+      Route& route = m_routes[chan];
+      if (route.kind < 0) {
+        continue;
+      }
+
+      const float* data = input->getChannelData((int32_t)chan);
+      const int n = input->numSamples;
+
+      int j = 0;
+      while ((j = findChange(data, j, n, route.raw)) < n) {
+        route.raw = data[j];
+        int value = quantize(route.kind, route.raw);
+        if (value != route.value) {
+          emit(route, value, (int)(outputPerInput * j), events);
+          route.value = value;
+        }
+        j++;
+      }
+    }
+
+    // Each channel's events are already in time order, so only the merge
+    // between channels needs sorting. A stable sort keeps simultaneous
+    // events in channel order.
+    std::stable_sort(events.begin() + firstNew, events.end());
+  }
+
+ private:
+  struct Route {
+    int kind;     // FaustCHOPMidiEvent::Type, or -1 to ignore the channel
+    int channel;  // MIDI channel (0-based)
+    int number;   // note or controller number
+    float raw;    // last sample seen
+    int value;    // last quantized value
+  };
+
+  // Index of the first sample in [start, n) that differs from `ref`.
+  // Comparing in fixed-size chunks without an early exit lets the compiler
+  // vectorize the common case where nothing changed.
+  static int findChange(const float* data, int start, int n, float ref) {
+    int j = start;
+    for (; j + 8 <= n; j += 8) {
+      int changed = 0;
+      for (int k = 0; k < 8; k++) {
+        changed |= data[j + k] != ref;
+      }
+      if (changed) {
+        break;
+      }
+    }
+    for (; j < n; j++) {
+      if (data[j] != ref) {
+        return j;
+      }
+    }
+    return n;
+  }
+
+  static int quantize(int kind, float v) {
+    switch (kind) {
+      case FaustCHOPMidiEvent::kPitchBend:
+        return std::max(0, std::min(16383, (int)(8192 + v * 8192)));
+      case FaustCHOPMidiEvent::kProgram:
+        return std::max(0, std::min(127, (int)std::lround(v)));
+      default:
+        return int(127 * v);
+    }
+  }
+
+  static void emit(const Route& route, int value, int offset,
+                   std::vector<FaustCHOPMidiEvent>& events) {
+    switch (route.kind) {
+      case FaustCHOPMidiEvent::kNoteOn:
+        // A velocity change while the note is held isn't an event.
+        if (value > 0 && route.value <= 0) {
+          events.push_back({offset, FaustCHOPMidiEvent::kNoteOn, route.channel,
+                            route.number, value});
+        } else if (value <= 0 && route.value > 0) {
+          events.push_back({offset, FaustCHOPMidiEvent::kNoteOff,
+                            route.channel, route.number, value});
+        }
+        break;
+      case FaustCHOPMidiEvent::kControl:
+        events.push_back({offset, FaustCHOPMidiEvent::kControl, route.channel,
+                          route.number, value});
+        break;
+      case FaustCHOPMidiEvent::kPitchBend:
+      case FaustCHOPMidiEvent::kProgram:
+        events.push_back({offset, route.kind, route.channel, value, 0});
+        break;
+    }
+  }
+
+  static bool parseNumber(const std::string& s, size_t pos, int& out) {
+    if (pos >= s.size() || !isdigit((unsigned char)s[pos])) {
+      return false;
+    }
+    char* end = nullptr;
+    out = (int)strtol(s.c_str() + pos, &end, 10);
+    return *end == '\0';
+  }
+
+  static bool startsWith(const std::string& s, size_t pos, const char* prefix) {
+    return s.compare(pos, strlen(prefix), prefix) == 0;
+  }
+
+  static Route parseName(const char* name) {
+    Route route = {-1, 0, 0, 0.f, 0};
+
+    std::string s(name);
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return (char)tolower(c); });
+
+    size_t pos = 0;
+    if (startsWith(s, 0, "ch") && s.size() > 2 && isdigit((unsigned char)s[2])) {
+      char* end = nullptr;
+      int channel = (int)strtol(s.c_str() + 2, &end, 10);
+      route.channel = std::max(0, std::min(15, channel - 1));
+      pos = end - s.c_str();
+    }
+
+    int number = 0;
+    if (startsWith(s, pos, "pitchbend") && pos + 9 == s.size()) {
+      route.kind = FaustCHOPMidiEvent::kPitchBend;
+    } else if (startsWith(s, pos, "pb") && pos + 2 == s.size()) {
+      route.kind = FaustCHOPMidiEvent::kPitchBend;
+    } else if ((startsWith(s, pos, "program") && pos + 7 == s.size()) ||
+               (startsWith(s, pos, "prog") && pos + 4 == s.size())) {
+      route.kind = FaustCHOPMidiEvent::kProgram;
+    } else if ((startsWith(s, pos, "note") && parseNumber(s, pos + 4, number)) ||
+               (startsWith(s, pos, "n") && parseNumber(s, pos + 1, number))) {
+      route.kind = FaustCHOPMidiEvent::kNoteOn;
+      route.number = number;
+    } else if ((startsWith(s, pos, "cc") && parseNumber(s, pos + 2, number)) ||
+               (startsWith(s, pos, "c") && parseNumber(s, pos + 1, number))) {
+      route.kind = FaustCHOPMidiEvent::kControl;
+      route.number = number;
+    }
+
+    if (route.number < 0 || route.number > 127) {
+      route.kind = -1;
+    }
+    if (route.kind == FaustCHOPMidiEvent::kPitchBend) {
+      route.value = 8192;
+    }
+    return route;
+  }
+
+  bool namesChanged(const TD::OP_CHOPInput* input) const {
+    if (input->opId != m_opId || (size_t)input->numChannels != m_names.size()) {
+      return true;
+    }
+    for (int i = 0; i < input->numChannels; i++) {
+      if (m_names[i] != input->getChannelName(i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void updateRoutes(const TD::OP_CHOPInput* input) {
+    // The name pointers are stable between cooks unless the input changed,
+    // so the string comparison only happens when they move.
+    if (input->numChannels == (int)m_namePtrs.size() &&
+        input->opId == m_opId &&
+        std::equal(m_namePtrs.begin(), m_namePtrs.end(), input->nameData)) {
+      return;
+    }
+    m_namePtrs.assign(input->nameData, input->nameData + input->numChannels);
+    if (!namesChanged(input)) {
+      return;
+    }
+
+    m_opId = input->opId;
+    m_names.clear();
+    m_routes.clear();
+
+    bool anyNamed = false;
+    for (int i = 0; i < input->numChannels; i++) {
+      m_names.push_back(input->getChannelName(i));
+      m_routes.push_back(parseName(input->getChannelName(i)));
+      anyNamed = anyNamed || m_routes.back().kind >= 0;
+    }
+
+    if (!anyNamed) {
+      // Legacy layout: one velocity channel per note number.
+      for (int i = 0; i < input->numChannels; i++) {
+        m_routes[i] = {i < 127 ? (int)FaustCHOPMidiEvent::kNoteOn : -1, 0, i,
+                       0.f, 0};
+      }
+    }
+  }
+
+  uint32_t m_opId = 0;
+  std::vector<const char*> m_namePtrs;
+  std::vector<std::string> m_names;
+  std::vector<Route> m_routes;
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPMidiDevice
+// desc: Receives MIDI from a device on the driver thread, stamps every
+//       message with a steady clock and queues it for the cook thread, which
+//       places it at a sample offset inside the timeslice being rendered.
+//
+// The timeslice of a cook is taken to end when execute() starts. A message
+// that arrived at time t is played at t + latency, so as long as the latency
+// covers the time between two cooks, messages keep their relative timing
+// instead of all landing on the first sample of the next cook. Messages that
+// would fall before the timeslice are played at its first sample and counted
+// as late; messages that fall after it wait for a later cook.
+//-----------------------------------------------------------------------------
+class FaustCHOPMidiDevice : public midi {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  using midi::chanPress;
+  using midi::ctrlChange;
+  using midi::keyOff;
+  using midi::keyOn;
+  using midi::keyPress;
+  using midi::pitchWheel;
+  using midi::progChange;
+
+  // Driver thread
+
+  MapUI* keyOn(int channel, int pitch, int velocity) override {
+    record(FaustCHOPMidiEvent::kNoteOn, channel, pitch, velocity);
+    return nullptr;
+  }
+
+  void keyOff(int channel, int pitch, int velocity) override {
+    record(FaustCHOPMidiEvent::kNoteOff, channel, pitch, velocity);
+  }
+
+  void keyPress(int channel, int pitch, int press) override {
+    record(FaustCHOPMidiEvent::kKeyPressure, channel, pitch, press);
+  }
+
+  void chanPress(int channel, int press) override {
+    record(FaustCHOPMidiEvent::kChannelPressure, channel, press, 0);
+  }
+
+  void ctrlChange(int channel, int ctrl, int value) override {
+    record(FaustCHOPMidiEvent::kControl, channel, ctrl, value);
+  }
+
+  void pitchWheel(int channel, int wheel) override {
+    record(FaustCHOPMidiEvent::kPitchBend, channel, wheel, 0);
+  }
+
+  void progChange(int channel, int pgm) override {
+    record(FaustCHOPMidiEvent::kProgram, channel, pgm, 0);
+  }
+
+  // Transport messages are forwarded as they arrive, like before.
+  void startSync(double date) override {
+    if (midi* target = m_passthrough.load()) {
+      target->startSync(date);
+    }
+  }
+
+  void stopSync(double date) override {
+    if (midi* target = m_passthrough.load()) {
+      target->stopSync(date);
+    }
+  }
+
+  void clock(double date) override {
+    if (midi* target = m_passthrough.load()) {
+      target->clock(date);
+    }
+  }
+
+  // Cook thread
+
+  void setPassthrough(midi* target) { m_passthrough.store(target); }
+
+  void clear() {
+    m_queue.clear();
+    m_pending.clear();
+  }
+
+  // Append the messages that fall inside the timeslice of `numSamples`
+  // samples ending at `cookTime` to `events`. The caller sorts them.
+  void schedule(Clock::time_point cookTime, double sampleRate, int numSamples,
+                double latency, std::vector<FaustCHOPMidiEvent>& events) {
+    const Clock::time_point sliceStart =
+        cookTime - std::chrono::duration_cast<Clock::duration>(
+                       std::chrono::duration<double>(numSamples / sampleRate));
+
+    TimedEvent timed;
+    while (m_queue.pop(timed)) {
+      // Without scheduling, the message would have been applied at the
+      // start of this timeslice.
+      addDelay(m_quantized, seconds(sliceStart - timed.time));
+      m_pending.push_back(timed);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_pending.size(); i++) {
+      TimedEvent& e = m_pending[i];
+      double offset =
+          (seconds(e.time - sliceStart) + latency) * sampleRate;
+      if (offset >= numSamples) {
+        m_pending[kept++] = e;
+        continue;
+      }
+      if (offset < 0) {
+        offset = 0;
+        m_numLate++;
+      }
+      e.event.offset = (int)offset;
+      events.push_back(e.event);
+    }
+    m_pending.resize(kept);
+  }
+
+  // Standard deviation, in milliseconds, of the delay between a message's
+  // arrival and the start of the timeslice it falls in: the jitter it would
+  // have if it were applied once per cook. Scheduled messages are delayed
+  // by the latency instead, to the sample, unless they are late.
+  double getQuantizedJitter() const { return 1000. * m_quantized.deviation(); }
+
+  int getNumLate() const { return m_numLate; }
+  // Messages lost because the queue was full between two cooks
+  int getNumDropped() const { return m_numDropped.load(); }
+
+ private:
+  struct TimedEvent {
+    FaustCHOPMidiEvent event;
+    Clock::time_point time;
+  };
+
+  // Exponentially weighted mean and variance over roughly the last 100
+  // messages.
+  struct DelayStats {
+    double mean = 0.;
+    double variance = 0.;
+    bool empty = true;
+
+    double deviation() const { return std::sqrt(variance); }
+  };
+
+  static double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+  }
+
+  static void addDelay(DelayStats& stats, double delay) {
+    const double alpha = 0.01;
+    if (stats.empty) {
+      stats.mean = delay;
+      stats.empty = false;
+      return;
+    }
+    const double diff = delay - stats.mean;
+    stats.mean += alpha * diff;
+    stats.variance = (1. - alpha) * (stats.variance + alpha * diff * diff);
+  }
+
+  void record(int type, int channel, int data1, int data2) {
+    TimedEvent e;
+    e.event = {0, type, channel, data1, data2, true};
+    e.time = Clock::now();
+    if (!m_queue.push(e)) {
+      m_numDropped++;
+    }
+  }
+
+  FaustCHOPQueue<TimedEvent, 1024> m_queue;
+  std::atomic<midi*> m_passthrough{nullptr};
+  std::atomic<int> m_numDropped{0};
+
+  std::vector<TimedEvent> m_pending;
+  DelayStats m_quantized;
+  int m_numLate = 0;
+};
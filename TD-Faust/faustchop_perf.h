@@ -0,0 +1,268 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPPerfCounters
+// desc: Hardware performance counters of the DSP of one Faust CHOP, through
+//       Linux perf_event. They only count while enabled between begin() and
+//       end(), around compute(), and only on the thread that opened them,
+//       which is the cooking thread.
+//
+// The counters are opened as one group so the PMU schedules them together
+// and their ratios hold; if the kernel has to share the PMU with other
+// events, the totals are scaled up to the whole time they were enabled. A
+// counter the CPU doesn't have is left out. When the counters can't be
+// opened at all (another OS, a VM without a virtual PMU, perf_event_paranoid
+// or a container denying access), error() says why and begin() and end()
+// do nothing.
+//-----------------------------------------------------------------------------
+class FaustCHOPPerfCounters {
+ public:
+  enum Counter {
+    kCycles,
+    kInstructions,
+    kL1DMisses,
+    kLLCMisses,
+    kBranchMisses,
+    kNumCounters
+  };
+
+  FaustCHOPPerfCounters() = default;
+  ~FaustCHOPPerfCounters() { close(); }
+  FaustCHOPPerfCounters(const FaustCHOPPerfCounters&) = delete;
+  FaustCHOPPerfCounters& operator=(const FaustCHOPPerfCounters&) = delete;
+
+  static const char* name(int counter) {
+    static const char* names[kNumCounters] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+    return names[counter];
+  }
+
+  // Opens the counters on the calling thread when `enabled` turns on, and
+  // closes them when it turns off. A failure isn't retried until then.
+  void setEnabled(bool enabled) {
+    if (enabled == m_enabled) {
+      return;
+    }
+    m_enabled = enabled;
+    if (enabled) {
+      open();
+    } else {
+      close();
+      m_error.clear();
+    }
+  }
+
+  bool isEnabled() const { return m_enabled; }
+  bool isOpen() const { return m_leader >= 0; }
+  // Why the counters couldn't be opened, or empty
+  const std::string& error() const { return m_error; }
+
+  // Starts counting. Cooking thread only.
+  void begin() {
+#if defined(__linux__)
+    if (m_leader < 0) {
+      return;
+    }
+    if (m_wantReset.exchange(false, std::memory_order_acquire)) {
+      ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      m_samples = 0;
+    }
+    ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  // Stops counting, after computing `numSamples`. Cooking thread only.
+  void end(int numSamples) {
+#if defined(__linux__)
+    if (m_leader < 0) {
+      return;
+    }
+    ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    m_samples += numSamples;
+#endif
+  }
+
+  // Zeroes the totals at the next begin().
+  void requestReset() { m_wantReset.store(true, std::memory_order_release); }
+
+  // Name and value rows for the Info DAT: the totals since the counters were
+  // opened or reset, the instructions per cycle, and each counter per
+  // sample computed.
+  void describe(std::vector<std::pair<std::string, std::string>>& rows) const {
+    if (!m_enabled) {
+      rows.push_back({"perf_counters", "off"});
+      return;
+    }
+    if (m_leader < 0) {
+      rows.push_back({"perf_counters", m_error});
+      return;
+    }
+    rows.push_back({"perf_counters", "on"});
+    rows.push_back({"perf_samples", std::to_string(m_samples)});
+
+    double values[kNumCounters];
+    bool available[kNumCounters];
+    read(values, available);
+
+    auto format = [](bool valid, double value) {
+      if (!valid) {
+        return std::string("n/a");
+      }
+      char text[64];
+      snprintf(text, sizeof(text), "%.6g", value);
+      return std::string(text);
+    };
+    for (int c = 0; c < kNumCounters; c++) {
+      rows.push_back({std::string("perf_") + name(c),
+                      format(available[c], values[c])});
+    }
+    rows.push_back(
+        {"perf_ipc",
+         format(available[kCycles] && available[kInstructions] &&
+                    values[kCycles] > 0.,
+                values[kInstructions] / values[kCycles])});
+    for (int c = 0; c < kNumCounters; c++) {
+      rows.push_back({std::string("perf_") + name(c) + "_per_sample",
+                      format(available[c] && m_samples > 0,
+                             values[c] / (double)m_samples)});
+    }
+  }
+
+ private:
+  void open() {
+    m_error.clear();
+    m_samples = 0;
+#if defined(__linux__)
+    static const std::pair<uint32_t, uint64_t> events[kNumCounters] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        // "Usually" the last level cache, says perf_event_open(2)
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+    m_numOpen = 0;
+    for (int c = 0; c < kNumCounters; c++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[c].first;
+      attr.config = events[c].second;
+      // The group starts disabled and is switched as a whole.
+      attr.disabled = m_leader < 0;
+      // Also what perf_event_paranoid 2, the usual default, allows
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+                                  m_leader, PERF_FLAG_FD_CLOEXEC);
+      if (fd < 0) {
+        if (m_leader < 0) {
+          m_error = describeError(errno);
+          return;
+        }
+        // This CPU doesn't have it; the others still count.
+        continue;
+      }
+      if (m_leader < 0) {
+        m_leader = fd;
+      }
+      m_fds[m_numOpen] = fd;
+      m_counters[m_numOpen] = c;
+      m_numOpen++;
+    }
+#else
+    m_error = "Hardware performance counters are only available on Linux";
+#endif
+  }
+
+  void close() {
+#if defined(__linux__)
+    // Members first, then the leader.
+    for (int i = m_numOpen - 1; i >= 0; i--) {
+      ::close(m_fds[i]);
+    }
+#endif
+    m_numOpen = 0;
+    m_leader = -1;
+  }
+
+  // The totals scaled up for multiplexing. A counter that never got onto
+  // the PMU is unavailable.
+  void read(double* values, bool* available) const {
+    for (int c = 0; c < kNumCounters; c++) {
+      values[c] = 0.;
+      available[c] = false;
+    }
+#if defined(__linux__)
+    // nr, time_enabled, time_running, then a value per counter
+    uint64_t data[3 + kNumCounters];
+    const ssize_t size = ::read(m_leader, data, sizeof(data));
+    if (size < (ssize_t)(3 * sizeof(uint64_t))) {
+      return;
+    }
+    const uint64_t count = std::min<uint64_t>(data[0], m_numOpen);
+    const uint64_t enabled = data[1];
+    const uint64_t running = data[2];
+    if (running == 0) {
+      // Nothing computed yet, or the PMU was never free.
+      for (uint64_t i = 0; i < count; i++) {
+        available[m_counters[i]] = enabled == 0;
+      }
+      return;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+      values[m_counters[i]] = (double)data[3 + i] * enabled / running;
+      available[m_counters[i]] = true;
+    }
+#endif
+  }
+
+  static std::string describeError(int error) {
+#if defined(__linux__)
+    if (error == EACCES || error == EPERM) {
+      return "Access to performance counters was denied. Lower "
+             "/proc/sys/kernel/perf_event_paranoid to 2 or less, or allow "
+             "perf_event_open in the container.";
+    }
+    if (error == ENOENT || error == ENODEV || error == EOPNOTSUPP) {
+      return "This machine has no hardware performance counters (a virtual "
+             "machine may not expose them).";
+    }
+    if (error == ENOSYS) {
+      return "The kernel was built without perf_event support.";
+    }
+#endif
+    return std::string("Could not open performance counters: ") +
+           strerror(error);
+  }
+
+  bool m_enabled = false;
+  std::string m_error;
+  int m_leader = -1;
+  int m_fds[kNumCounters] = {};
+  int m_counters[kNumCounters] = {};  // which Counter each of m_fds counts
+  int m_numOpen = 0;
+  int64_t m_samples = 0;
+  std::atomic<bool> m_wantReset{false};
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <faust/dsp/poly-dsp.h>
+
+#include "faustchop_voices.h"
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPPoly
+// desc: mydsp_poly whose voices are assigned by FaustCHOPVoiceAllocator
+//       instead of a linear search of the voice table on every key event.
+//       Everything else (grouped controls, dynamic voices, the release
+//       detection in compute) is left to mydsp_poly.
+//-----------------------------------------------------------------------------
+class FaustCHOPPoly : public mydsp_poly {
+ public:
+  FaustCHOPPoly(dsp* voice, int nvoices, bool control, bool group)
+      : mydsp_poly(voice, nvoices, control, group),
+        m_voices((int)fVoiceTable.size()) {}
+
+  MapUI* keyOn(int channel, int pitch, int velocity) override {
+    if (!checkPolyphony()) {
+      return nullptr;
+    }
+    FaustCHOPVoiceAllocator::State previous;
+    int voice = m_voices.noteOn(pitch, previous);
+    if (voice == FaustCHOPVoiceAllocator::kNone) {
+      return nullptr;
+    }
+    dsp_voice* v = fVoiceTable[voice];
+    // Same as mydsp_poly::getFreeVoice: a voice taken from another note,
+    // playing or still in its release tail, is retriggered legato so it
+    // doesn't click. A released voice that has already gone silent but
+    // hasn't been reclaimed yet starts like a free one.
+    if (previous != FaustCHOPVoiceAllocator::kFree &&
+        v->fCurNote != kFreeVoice) {
+      v->fCurNote = kLegatoVoice;
+    }
+    v->keyOn(pitch, velocity, v->fCurNote == kLegatoVoice);
+    return v;
+  }
+
+  void keyOff(int channel, int pitch, int velocity = 127) override {
+    if (!checkPolyphony()) {
+      return;
+    }
+    int voice = m_voices.noteOff(pitch);
+    if (voice != FaustCHOPVoiceAllocator::kNone) {
+      fVoiceTable[voice]->keyOff();
+    }
+  }
+
+  void ctrlChange(int channel, int ctrl, int value) override {
+    mydsp_poly::ctrlChange(channel, ctrl, value);
+    if (ctrl == ALL_NOTES_OFF || ctrl == ALL_SOUND_OFF) {
+      m_voices.releaseAll();
+    }
+  }
+
+  void instanceClear() override {
+    mydsp_poly::instanceClear();
+    m_voices.reset();
+  }
+
+  void compute(int count, FAUSTFLOAT** inputs, FAUSTFLOAT** outputs) override {
+    mydsp_poly::compute(count, inputs, outputs);
+    reclaimVoices();
+  }
+
+ protected:
+  // mydsp_poly marks a voice kFreeVoice inside compute() once its release
+  // has decayed. Only the released voices need checking, so this scales
+  // with activity rather than with the number of voices.
+  void reclaimVoices() {
+    m_voices.forEachReleased([this](int v) {
+      if (fVoiceTable[v]->fCurNote == kFreeVoice) {
+        m_voices.free(v);
+      }
+    });
+  }
+
+  FaustCHOPVoiceAllocator m_voices;
+};
+
+// Same structure as dsp_poly_factory::createPolyDSPInstance, but with
+// FaustCHOPPoly managing the voices. `voices` receives the voice DSP so
+// that callers can reach it behind the effect wrapper.
+inline dsp_poly* createFaustCHOPPolyInstance(dsp_poly_factory* factory,
+                                             int nvoices, bool control,
+                                             bool group,
+                                             FaustCHOPPoly** voices) {
+  FaustCHOPPoly* poly = new FaustCHOPPoly(
+      factory->fProcessFactory->createDSPInstance(), nvoices, control, group);
+  if (voices) {
+    *voices = poly;
+  }
+  if (factory->fEffectFactory) {
+    return new dsp_poly_effect(
+        poly,
+        new dsp_sequencer(poly, factory->fEffectFactory->createDSPInstance()));
+  }
+  return new dsp_poly_effect(poly, poly);
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <faust/gui/Soundfile.h>
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPPrefetcher
+// desc: A thread that reads streamed soundfiles ahead of the voices playing
+//       them, so the cook doesn't wait for the disk when a voice runs past
+//       the locked head of a sample.
+//
+// The soundfile primitive doesn't say where a DSP reads, so the position
+// of a voice is estimated from what the OS reports as resident: when the
+// first whole page past the head of a part comes in, a voice has started
+// on the rest of it, and it is assumed to move through it one frame per
+// sample at the DSP's rate. Every tick, the `ahead` frames past that
+// position are asked for (MADV_WILLNEED, PrefetchVirtualMemory) in every
+// channel. A voice played faster than that falls back on the OS's own
+// read-ahead; a voice that stops early has the rest of its part read ahead
+// for nothing. A part is watched again once that page has been dropped,
+// which under memory pressure is soon after it was played.
+//
+// The thread is started on the first add() and holds the soundfiles until
+// clear(), so their mappings can't go away while it reads them.
+//-----------------------------------------------------------------------------
+class FaustCHOPPrefetcher {
+ public:
+  FaustCHOPPrefetcher() = default;
+  FaustCHOPPrefetcher(const FaustCHOPPrefetcher&) = delete;
+  FaustCHOPPrefetcher& operator=(const FaustCHOPPrefetcher&) = delete;
+  ~FaustCHOPPrefetcher() { stop(); }
+
+  // Watch the parts of a streamed soundfile whose first `headFrames` are
+  // locked in memory, played by a DSP running at `sampleRate`.
+  void add(const std::shared_ptr<Soundfile>& soundfile, int headFrames,
+           int sampleRate) {
+    if (!soundfile || sampleRate <= 0) {
+      return;
+    }
+    Stream stream = soundfile->fIsDouble
+                        ? makeStream<double>(soundfile, headFrames, sampleRate)
+                        : makeStream<float>(soundfile, headFrames, sampleRate);
+    if (stream.parts.empty()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_thread.joinable()) {
+      m_stopping = false;
+      m_thread = std::thread([this]() { run(); });
+    }
+    m_added.push_back(std::move(stream));
+    m_wake.notify_one();
+  }
+
+  // Forget every soundfile, on the next tick.
+  void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_added.clear();
+    m_clear = true;
+    m_wake.notify_one();
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+      m_added.clear();
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  static constexpr std::chrono::milliseconds kTick{10};
+  // Smallest read asked for, so a slow voice doesn't cost a system call on
+  // every tick.
+  static const uint64_t kMinRequest = 64 * 1024;
+
+  struct Part {
+    std::vector<const char*> tails;  // first byte past the head, per channel
+    // First whole page past the head of the first channel; the page the head
+    // ends in is locked with it.
+    const char* probe = nullptr;
+    uint64_t length = 0;             // bytes past the head
+    bool armed = false;  // the first page past the head was out at last tick
+    bool playing = false;
+    Clock::time_point start;
+    uint64_t fetched = 0;  // bytes past the head asked for so far
+  };
+
+  struct Stream {
+    std::shared_ptr<Soundfile> soundfile;
+    std::vector<Part> parts;
+    double bytesPerSecond = 0.;
+    uint64_t ahead = 0;
+  };
+
+  template <typename REAL>
+  static Stream makeStream(const std::shared_ptr<Soundfile>& soundfile,
+                           int headFrames, int sampleRate) {
+    Stream stream;
+    stream.soundfile = soundfile;
+    stream.bytesPerSecond = (double)sampleRate * sizeof(REAL);
+    // At least half a second, which is more than the OS reads ahead by
+    // itself.
+    stream.ahead =
+        (uint64_t)std::max(headFrames, sampleRate / 2) * sizeof(REAL);
+    // Channels past the real ones share their buffers.
+    REAL** buffers = static_cast<REAL**>(soundfile->fBuffers);
+    std::set<REAL*> channels(buffers, buffers + MAX_CHAN);
+    for (int part = 0; part < soundfile->fParts; part++) {
+      const int head = std::max(0, headFrames);
+      if (soundfile->fLength[part] <= head) {
+        continue;
+      }
+      Part p;
+      for (REAL* channel : channels) {
+        p.tails.push_back(
+            (const char*)(channel + soundfile->fOffset[part] + head));
+      }
+      p.length = (uint64_t)(soundfile->fLength[part] - head) * sizeof(REAL);
+      const uint64_t page = pageSize();
+      const uint64_t skip = (page - (uintptr_t)p.tails[0] % page) % page;
+      if (skip >= p.length) {
+        continue;
+      }
+      p.probe = p.tails[0] + skip;
+      p.armed = !isResident(p.probe);
+      stream.parts.push_back(std::move(p));
+    }
+    return stream;
+  }
+
+  void run() {
+    std::vector<Stream> streams;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto wake = [this]() {
+          return m_stopping || m_clear || !m_added.empty();
+        };
+        if (streams.empty()) {
+          m_wake.wait(lock, wake);
+        } else {
+          m_wake.wait_for(lock, kTick, wake);
+        }
+        if (m_stopping) {
+          return;
+        }
+        if (m_clear) {
+          streams.clear();
+          m_clear = false;
+        }
+        for (Stream& stream : m_added) {
+          streams.push_back(std::move(stream));
+        }
+        m_added.clear();
+      }
+      const Clock::time_point now = Clock::now();
+      for (Stream& stream : streams) {
+        for (Part& part : stream.parts) {
+          tick(stream, part, now);
+        }
+      }
+    }
+  }
+
+  static void tick(const Stream& stream, Part& part, Clock::time_point now) {
+    if (!part.playing) {
+      const bool resident = isResident(part.probe);
+      if (resident && part.armed) {
+        part.playing = true;
+        part.start = now;
+        part.fetched = 0;
+      }
+      part.armed = !resident;
+      if (!part.playing) {
+        return;
+      }
+    }
+    const double seconds =
+        std::chrono::duration<double>(now - part.start).count();
+    const uint64_t position = (uint64_t)(seconds * stream.bytesPerSecond);
+    if (position >= part.length) {
+      part.playing = false;
+      part.armed = !isResident(part.probe);
+      return;
+    }
+    const uint64_t target = std::min(part.length, position + stream.ahead);
+    if (target < part.length && target < part.fetched + kMinRequest) {
+      return;
+    }
+    if (target > part.fetched) {
+      for (const char* tail : part.tails) {
+        willNeed(tail + part.fetched, target - part.fetched);
+      }
+      part.fetched = target;
+    }
+  }
+
+  static uint64_t pageSize() {
+#ifdef _WIN32
+    static const uint64_t page = []() {
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return (uint64_t)info.dwPageSize;
+    }();
+#else
+    static const uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+    return page;
+  }
+
+  // Whether the page holding `address` is in memory. Where the OS can't
+  // tell, it is reported resident, so nothing is ever read ahead.
+  static bool isResident(const char* address) {
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0601
+    PSAPI_WORKING_SET_EX_INFORMATION info = {};
+    info.VirtualAddress = (PVOID)address;
+    return !QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info)) ||
+           info.VirtualAttributes.Valid;
+#else
+    return true;
+#endif
+#else
+    const uint64_t page = pageSize();
+    void* start = (void*)((uintptr_t)address / page * page);
+#ifdef __APPLE__
+    char vec = 0;
+#else
+    unsigned char vec = 0;
+#endif
+    return mincore(start, 1, &vec) != 0 || (vec & 1);
+#endif
+  }
+
+  static void willNeed(const char* address, uint64_t length) {
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)address;
+    range.NumberOfBytes = (SIZE_T)length;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    const uint64_t page = pageSize();
+    const uintptr_t start = (uintptr_t)address / page * page;
+    madvise((void*)start, (size_t)((uintptr_t)address + length - start),
+            MADV_WILLNEED);
+#endif
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::vector<Stream> m_added;
+  bool m_clear = false;
+  bool m_stopping = false;
+  std::thread m_thread;
+};
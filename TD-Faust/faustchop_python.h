@@ -0,0 +1,462 @@
+#pragma once
+
+#include <Python.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "faustchop_midi.h"
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPPyEvents
+// desc: Reads a batch of MIDI events passed to the Python method sendEvents.
+//
+// Each event is (type, channel, data1, data2[, offset]), where type is a
+// FaustCHOPMidiEvent::Type and offset is a sample offset from the start of
+// the next cook (default 0). Accepted batches:
+//   - a list or tuple of such tuples (or lists)
+//   - a C-contiguous 2D integer array with 4 or 5 columns
+//   - a 1D structured array whose fields are all the same integer type
+// Arrays are read through the buffer protocol, so numpy isn't needed to
+// build the plugin. The whole batch is parsed in one pass; on error a Python
+// exception is set and `events` is left unchanged.
+//-----------------------------------------------------------------------------
+class FaustCHOPPyEvents {
+ public:
+  static bool parse(PyObject* obj, std::vector<FaustCHOPMidiEvent>& events) {
+    if (PyObject_CheckBuffer(obj)) {
+      return parseBuffer(obj, events);
+    }
+    return parseSequence(obj, events);
+  }
+
+ private:
+  static void append(const int64_t (&fields)[5],
+                     std::vector<FaustCHOPMidiEvent>& events) {
+    FaustCHOPMidiEvent event;
+    event.type = (int)fields[0];
+    event.channel = (int)fields[1];
+    event.data1 = (int)fields[2];
+    event.data2 = (int)fields[3];
+    event.offset = (int)fields[4];
+    events.push_back(event);
+  }
+
+  static bool parseSequence(PyObject* obj,
+                            std::vector<FaustCHOPMidiEvent>& events) {
+    PyObject* seq = PySequence_Fast(
+        obj,
+        "sendEvents expects a list of (type, channel, data1, data2[, offset]) "
+        "tuples or an integer array");
+    if (!seq) {
+      return false;
+    }
+    const Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject** items = PySequence_Fast_ITEMS(seq);
+    const size_t first = events.size();
+    events.reserve(first + (size_t)n);
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+      PyObject* item = PySequence_Fast(items[i], "events must be tuples");
+      if (!item) {
+        break;
+      }
+      const Py_ssize_t size = PySequence_Fast_GET_SIZE(item);
+      if (size != 4 && size != 5) {
+        PyErr_Format(PyExc_ValueError,
+                     "event %zd has %zd values, expected 4 or 5", i, size);
+        Py_DECREF(item);
+        break;
+      }
+      int64_t fields[5] = {0, 0, 0, 0, 0};
+      PyObject** values = PySequence_Fast_ITEMS(item);
+      for (Py_ssize_t k = 0; k < size; k++) {
+        fields[k] = PyLong_AsLongLong(values[k]);
+      }
+      Py_DECREF(item);
+      if (PyErr_Occurred()) {
+        break;
+      }
+      append(fields, events);
+    }
+    Py_DECREF(seq);
+
+    if (PyErr_Occurred()) {
+      events.resize(first);
+      return false;
+    }
+    return true;
+  }
+
+  // Strip the byte order from a struct format code. Only native and
+  // little-endian signed integers of 4 or 8 bytes are accepted.
+  static char intCode(const char*& format) {
+    if (*format == '@' || *format == '=' || *format == '<') {
+      format++;
+    }
+    char code = *format;
+    if (code == 'i' || code == 'l' || code == 'q') {
+      format++;
+      return code;
+    }
+    return 0;
+  }
+
+  // Number of fields in a "T{<i:type:<i:channel:...}" record, or 0 if they
+  // aren't all the same integer type.
+  static int recordFields(const char* format) {
+    if (strncmp(format, "T{", 2) != 0) {
+      return 0;
+    }
+    format += 2;
+    char first = 0;
+    int fields = 0;
+    while (*format && *format != '}') {
+      char code = intCode(format);
+      if (!code || (first && code != first)) {
+        return 0;
+      }
+      first = code;
+      fields++;
+      if (*format == ':') {  // skip the field name
+        const char* end = strchr(format + 1, ':');
+        if (!end) {
+          return 0;
+        }
+        format = end + 1;
+      }
+    }
+    return *format == '}' ? fields : 0;
+  }
+
+  static bool parseBuffer(PyObject* obj,
+                          std::vector<FaustCHOPMidiEvent>& events) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) !=
+        0) {
+      return false;
+    }
+
+    const char* format = view.format ? view.format : "B";
+    Py_ssize_t rows = 0;
+    int fields = 0;
+    if (view.ndim == 2 && intCode(format) && !*format) {
+      rows = view.shape[0];
+      fields = (int)view.shape[1];
+    } else if (view.ndim == 1) {
+      rows = view.shape[0];
+      fields = recordFields(format);
+    }
+    const Py_ssize_t fieldSize =
+        fields ? (view.ndim == 2 ? view.itemsize : view.itemsize / fields) : 0;
+    if ((fields != 4 && fields != 5) || (fieldSize != 4 && fieldSize != 8)) {
+      PyErr_SetString(PyExc_TypeError,
+                      "sendEvents expects an integer array with 4 or 5 "
+                      "columns, or a structured array of 4 or 5 integer "
+                      "fields");
+      PyBuffer_Release(&view);
+      return false;
+    }
+
+    events.reserve(events.size() + (size_t)rows);
+    const char* p = (const char*)view.buf;
+    for (Py_ssize_t i = 0; i < rows; i++) {
+      int64_t row[5] = {0, 0, 0, 0, 0};
+      for (int k = 0; k < fields; k++, p += fieldSize) {
+        if (fieldSize == 4) {
+          int32_t value;
+          memcpy(&value, p, 4);
+          row[k] = value;
+        } else {
+          memcpy(&row[k], p, 8);
+        }
+      }
+      append(row, events);
+    }
+    PyBuffer_Release(&view);
+    return true;
+  }
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPZoneViews
+// desc: Parameter and bargraph values of a DSP as flat arrays that Python
+//       reads and writes through memoryviews (or numpy.frombuffer), with a
+//       table of their paths.
+//
+// Zones are scattered through the DSP's memory, so each kind is mirrored
+// into one contiguous array, held in a bytearray so that a view taken
+// before a recompile stays valid (it then just no longer affects the DSP).
+// Parameter values written from Python are applied to the zones at the
+// next block boundary; values changed by the DSP or other inputs are copied
+// back at the same time. Bargraphs are copied out once per cook. Nothing is
+// synced until Python has asked for a view. The arrays are only touched on
+// the thread that cooks the CHOP and runs its Python. A host without a
+// Python interpreter gets no arrays, and nothing is synced.
+//-----------------------------------------------------------------------------
+class FaustCHOPZoneViews {
+ public:
+  struct Zones {
+    std::vector<std::string> paths;
+    std::vector<FAUSTFLOAT*> zones;
+  };
+
+  ~FaustCHOPZoneViews() { reset(); }
+
+  // After compiling.
+  void build(const Zones& params, const Zones& bargraphs) {
+    reset();
+    if (!Py_IsInitialized()) {
+      return;
+    }
+    PyGILState_STATE gil = PyGILState_Ensure();
+    m_params.build(params);
+    m_bargraphs.build(bargraphs);
+    PyGILState_Release(gil);
+    m_applied.resize(m_params.zones.size());
+    for (size_t i = 0; i < m_params.zones.size(); i++) {
+      m_applied[i] = m_params.data()[i] = *m_params.zones[i];
+    }
+    syncBargraphs();
+  }
+
+  void reset() {
+    if (!m_params.array && !m_bargraphs.array) {
+      return;
+    }
+    if (Py_IsInitialized()) {
+      PyGILState_STATE gil = PyGILState_Ensure();
+      m_params.reset();
+      m_bargraphs.reset();
+      PyGILState_Release(gil);
+    } else {
+      // The interpreter was finalized first and took the arrays with it.
+      m_params = Array();
+      m_bargraphs = Array();
+    }
+    m_applied.clear();
+    m_active = false;
+  }
+
+  // At a block boundary. Returns true if a value written from Python was
+  // applied.
+  bool syncParams() {
+    if (!m_active) {
+      return false;
+    }
+    bool changed = false;
+    FAUSTFLOAT* values = m_params.data();
+    for (size_t i = 0; i < m_applied.size(); i++) {
+      if (values[i] != m_applied[i]) {
+        *m_params.zones[i] = values[i];
+        changed = true;
+      }
+      m_applied[i] = values[i] = *m_params.zones[i];
+    }
+    return changed;
+  }
+
+  void syncBargraphs() {
+    FAUSTFLOAT* values = m_bargraphs.data();
+    for (size_t i = 0; i < m_bargraphs.zones.size(); i++) {
+      values[i] = *m_bargraphs.zones[i];
+    }
+  }
+
+  bool isActive() const { return m_active; }
+
+  // Python getters: new references, None before a DSP is compiled.
+  PyObject* paramValues() { return view(m_params, false); }
+  PyObject* bargraphValues() { return view(m_bargraphs, true); }
+  PyObject* paramPaths() { return paths(m_params); }
+  PyObject* bargraphPaths() { return paths(m_bargraphs); }
+
+ private:
+  struct Array {
+    PyObject* array = nullptr;  // bytearray of FAUSTFLOAT
+    PyObject* paths = nullptr;  // tuple of str
+    std::vector<FAUSTFLOAT*> zones;
+
+    // With the GIL held.
+    void build(const Zones& source) {
+      zones = source.zones;
+      array = PyByteArray_FromStringAndSize(
+          nullptr, (Py_ssize_t)(zones.size() * sizeof(FAUSTFLOAT)));
+      paths = PyTuple_New((Py_ssize_t)source.paths.size());
+      for (size_t i = 0; paths && i < source.paths.size(); i++) {
+        PyTuple_SET_ITEM(paths, (Py_ssize_t)i,
+                         PyUnicode_FromString(source.paths[i].c_str()));
+      }
+      if (!array || !paths) {
+        PyErr_Clear();
+        reset();
+      }
+    }
+
+    // With the GIL held.
+    void reset() {
+      Py_CLEAR(array);
+      Py_CLEAR(paths);
+      zones.clear();
+    }
+
+    FAUSTFLOAT* data() {
+      return array ? (FAUSTFLOAT*)PyByteArray_AS_STRING(array) : nullptr;
+    }
+  };
+
+  PyObject* view(Array& values, bool readOnly) {
+    if (!values.array) {
+      Py_RETURN_NONE;
+    }
+    m_active = true;
+    PyObject* bytes = PyMemoryView_FromObject(values.array);
+    if (bytes && readOnly) {
+      PyObject* readOnlyBytes = PyObject_CallMethod(bytes, "toreadonly", NULL);
+      Py_DECREF(bytes);
+      bytes = readOnlyBytes;
+    }
+    if (!bytes) {
+      return nullptr;
+    }
+    PyObject* result = PyObject_CallMethod(
+        bytes, "cast", "s", sizeof(FAUSTFLOAT) == sizeof(float) ? "f" : "d");
+    Py_DECREF(bytes);
+    return result;
+  }
+
+  static PyObject* paths(Array& values) {
+    if (!values.paths) {
+      Py_RETURN_NONE;
+    }
+    Py_INCREF(values.paths);
+    return values.paths;
+  }
+
+  Array m_params;
+  Array m_bargraphs;
+  std::vector<FAUSTFLOAT> m_applied;  // parameter values as of the last sync
+  bool m_active = false;
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPPyMatrix
+// desc: Reads a 2D array of numbers (rows of equal length) into a flat
+//       vector of FAUSTFLOAT: a float32, float64 or integer array through the
+//       buffer protocol, or a list of lists. A 1D array or flat list is one
+//       row. On error a Python exception is set.
+//-----------------------------------------------------------------------------
+class FaustCHOPPyMatrix {
+ public:
+  static bool parse(PyObject* obj, const char* name,
+                    std::vector<FAUSTFLOAT>& values, Py_ssize_t& rows,
+                    Py_ssize_t& cols) {
+    values.clear();
+    if (PyObject_CheckBuffer(obj)) {
+      return parseBuffer(obj, name, values, rows, cols);
+    }
+    return parseSequence(obj, name, values, rows, cols);
+  }
+
+ private:
+  template <typename T>
+  static void copy(const char* p, Py_ssize_t n, std::vector<FAUSTFLOAT>& out) {
+    for (Py_ssize_t i = 0; i < n; i++, p += sizeof(T)) {
+      T value;
+      memcpy(&value, p, sizeof(T));
+      out.push_back((FAUSTFLOAT)value);
+    }
+  }
+
+  static bool parseBuffer(PyObject* obj, const char* name,
+                          std::vector<FAUSTFLOAT>& values, Py_ssize_t& rows,
+                          Py_ssize_t& cols) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) !=
+        0) {
+      return false;
+    }
+    const char* format = view.format ? view.format : "B";
+    if (*format == '@' || *format == '=' || *format == '<') {
+      format++;
+    }
+    const char code = format[0] && !format[1] ? format[0] : 0;
+    const bool ok = (view.ndim == 1 || view.ndim == 2) &&
+                    ((code == 'f' && view.itemsize == 4) ||
+                     (code == 'd' && view.itemsize == 8) ||
+                     ((code == 'i' || code == 'l' || code == 'q') &&
+                      (view.itemsize == 4 || view.itemsize == 8)));
+    if (!ok) {
+      PyErr_Format(PyExc_TypeError,
+                   "%s must be a 1D or 2D array of float32, float64 or "
+                   "integers",
+                   name);
+      PyBuffer_Release(&view);
+      return false;
+    }
+    rows = view.ndim == 2 ? view.shape[0] : 1;
+    cols = view.ndim == 2 ? view.shape[1] : view.shape[0];
+    const Py_ssize_t n = rows * cols;
+    values.reserve((size_t)n);
+    const char* p = (const char*)view.buf;
+    if (code == 'f') {
+      copy<float>(p, n, values);
+    } else if (code == 'd') {
+      copy<double>(p, n, values);
+    } else if (view.itemsize == 4) {
+      copy<int32_t>(p, n, values);
+    } else {
+      copy<int64_t>(p, n, values);
+    }
+    PyBuffer_Release(&view);
+    return true;
+  }
+
+  static bool parseSequence(PyObject* obj, const char* name,
+                            std::vector<FAUSTFLOAT>& values, Py_ssize_t& rows,
+                            Py_ssize_t& cols) {
+    PyObject* seq = PySequence_Fast(obj, "expected a list or an array");
+    if (!seq) {
+      return false;
+    }
+    const Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject** items = PySequence_Fast_ITEMS(seq);
+    const bool nested = n > 0 && PySequence_Check(items[0]) &&
+                        !PyUnicode_Check(items[0]);
+    rows = nested ? n : 1;
+    cols = nested ? -1 : n;
+
+    for (Py_ssize_t r = 0; r < rows && !PyErr_Occurred(); r++) {
+      PyObject* row = nested ? PySequence_Fast(items[r], "expected a list")
+                             : (Py_INCREF(seq), seq);
+      if (!row) {
+        break;
+      }
+      const Py_ssize_t size = PySequence_Fast_GET_SIZE(row);
+      if (cols < 0) {
+        cols = size;
+      }
+      if (size != cols) {
+        PyErr_Format(PyExc_ValueError,
+                     "%s: row %zd has %zd values, expected %zd", name, r,
+                     size, cols);
+      }
+      PyObject** cells = PySequence_Fast_ITEMS(row);
+      for (Py_ssize_t c = 0; c < size && !PyErr_Occurred(); c++) {
+        values.push_back((FAUSTFLOAT)PyFloat_AsDouble(cells[c]));
+      }
+      Py_DECREF(row);
+    }
+    Py_DECREF(seq);
+    if (cols < 0) {
+      cols = 0;
+    }
+    if (PyErr_Occurred()) {
+      values.clear();
+      return false;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPQueue
+// desc: Bounded lock-free queue for exactly one producer thread and one
+//       consumer thread. Neither side allocates or blocks, so it is safe to
+//       push from a driver callback and pop from the cook thread.
+//       `Capacity` must be a power of two; one slot is always left empty.
+//-----------------------------------------------------------------------------
+template <class T, size_t Capacity>
+class FaustCHOPQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  // Producer only. Returns false if the queue is full.
+  bool push(const T& item) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    const size_t next = (head + 1) & (Capacity - 1);
+    if (next == m_tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    m_items[head] = item;
+    m_head.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false if the queue is empty.
+  bool pop(T& item) {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = m_items[tail];
+    m_tail.store((tail + 1) & (Capacity - 1), std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only.
+  void clear() {
+    m_tail.store(m_head.load(std::memory_order_acquire),
+                 std::memory_order_release);
+  }
+
+ private:
+  T m_items[Capacity];
+  // Kept on separate cache lines so the two threads don't share one.
+  alignas(64) std::atomic<size_t> m_head{0};
+  alignas(64) std::atomic<size_t> m_tail{0};
+};
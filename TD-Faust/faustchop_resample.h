@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPResampler
+// desc: Windowed-sinc sample rate converter for soundfiles, used once at load
+//       time (see FaustCHOPStream), so it favours quality over speed.
+//
+// Each output sample is the dot product of 2 * half input samples with a
+// Kaiser-windowed sinc, linearly interpolated between kPhases precomputed
+// fractional delays. When downsampling, the cutoff is lowered to the output
+// Nyquist frequency. Positions are tracked as exact fractions of the two
+// rates, so long files don't drift. The dot product is written as kLanes
+// independent accumulators over contiguous taps so that compilers turn it
+// into SIMD code without needing fast-math.
+//-----------------------------------------------------------------------------
+class FaustCHOPResampler {
+ public:
+  static const int kLanes = 8;
+  static const int kPhases = 256;
+  static const int kZeroCrossings = 24;
+
+  FaustCHOPResampler(int inRate, int outRate) {
+    const int64_t g = std::gcd((int64_t)inRate, (int64_t)outRate);
+    m_step = inRate / g;
+    m_den = outRate / g;
+
+    // Leave a little transition band below Nyquist.
+    const double cutoff = 0.97 * std::min(1., (double)outRate / inRate);
+    m_half = (int)std::ceil(kZeroCrossings / cutoff);
+    m_half = (m_half + kLanes / 2 - 1) / (kLanes / 2) * (kLanes / 2);
+    m_taps = 2 * m_half;
+
+    const double beta = 9.;  // about 90 dB of stopband attenuation
+    const double norm = 1. / bessel0(beta);
+    std::vector<double> table((size_t)(kPhases + 1) * m_taps);
+    for (int phase = 0; phase <= kPhases; phase++) {
+      const double frac = (double)phase / kPhases;
+      for (int k = 0; k < m_taps; k++) {
+        // Distance from the output position to input sample k.
+        const double x = k - m_half + 1 - frac;
+        const double r = x / m_half;
+        const double window =
+            r * r < 1. ? bessel0(beta * std::sqrt(1. - r * r)) * norm : 0.;
+        table[(size_t)phase * m_taps + k] = cutoff * sinc(cutoff * x) * window;
+      }
+    }
+    // Store each phase with its difference to the next one, so the
+    // interpolation is a single multiply-add per tap.
+    m_filters.resize((size_t)kPhases * m_taps);
+    m_deltas.resize((size_t)kPhases * m_taps);
+    for (size_t i = 0; i < m_filters.size(); i++) {
+      m_filters[i] = (float)table[i];
+      m_deltas[i] = (float)(table[i + m_taps] - table[i]);
+    }
+  }
+
+  // Number of output samples for `frames` input samples.
+  int64_t outputLength(int64_t frames) const {
+    return (frames * m_den + m_step - 1) / m_step;
+  }
+
+  //---------------------------------------------------------------------------
+  // name: class FaustCHOPResampler::Channel
+  // desc: Resamples one channel fed in pieces of any size.
+  //---------------------------------------------------------------------------
+  template <typename REAL>
+  class Channel {
+   public:
+    // Produces exactly `length` samples in total.
+    Channel(const FaustCHOPResampler& resampler, int64_t length)
+        : m_resampler(resampler),
+          m_length(length),
+          m_first(1 - resampler.m_half),
+          m_input((size_t)(resampler.m_half - 1), (REAL)0) {}
+
+    // Append input samples and add every output sample they complete to
+    // `out`.
+    void push(const REAL* in, size_t count, std::vector<REAL>& out) {
+      m_input.insert(m_input.end(), in, in + count);
+      produce(out);
+    }
+
+    // The input has ended: add the remaining output samples to `out`.
+    void finish(std::vector<REAL>& out) {
+      const std::vector<REAL> zeros((size_t)m_resampler.m_taps, (REAL)0);
+      while (m_n < m_length) {
+        push(zeros.data(), zeros.size(), out);
+      }
+    }
+
+   private:
+    void produce(std::vector<REAL>& out) {
+      const FaustCHOPResampler& r = m_resampler;
+      for (; m_n < m_length; m_n++) {
+        const int64_t position = m_n * r.m_step;
+        const int64_t start = position / r.m_den - r.m_half + 1;
+        if (start + r.m_taps > m_first + (int64_t)m_input.size()) {
+          break;
+        }
+        const double phase =
+            (double)(position % r.m_den) * kPhases / (double)r.m_den;
+        const int index = std::min((int)phase, kPhases - 1);
+        out.push_back(r.dot(m_input.data() + (start - m_first), index,
+                            (REAL)(phase - index)));
+      }
+
+      // Drop the input no later output needs.
+      const int64_t next = m_n * r.m_step / r.m_den - r.m_half + 1;
+      const size_t used = (size_t)std::clamp<int64_t>(
+          next - m_first, 0, (int64_t)m_input.size());
+      m_input.erase(m_input.begin(), m_input.begin() + used);
+      m_first += (int64_t)used;
+    }
+
+    const FaustCHOPResampler& m_resampler;
+    int64_t m_length;
+    int64_t m_n = 0;   // next output sample
+    int64_t m_first;   // input index of m_input[0]
+    std::vector<REAL> m_input;
+  };
+
+ private:
+  template <typename REAL>
+  REAL dot(const REAL* in, int phase, REAL frac) const {
+    const float* filter = m_filters.data() + (size_t)phase * m_taps;
+    const float* delta = m_deltas.data() + (size_t)phase * m_taps;
+    REAL acc[kLanes] = {};
+    for (int k = 0; k < m_taps; k += kLanes) {
+      for (int lane = 0; lane < kLanes; lane++) {
+        acc[lane] += in[k + lane] *
+                     ((REAL)filter[k + lane] + frac * (REAL)delta[k + lane]);
+      }
+    }
+    REAL sum = 0;
+    for (int lane = 0; lane < kLanes; lane++) {
+      sum += acc[lane];
+    }
+    return sum;
+  }
+
+  static double sinc(double x) {
+    if (std::abs(x) < 1e-9) {
+      return 1.;
+    }
+    const double pix = 3.14159265358979323846 * x;
+    return std::sin(pix) / pix;
+  }
+
+  // Modified Bessel function of the first kind, order 0.
+  static double bessel0(double x) {
+    double sum = 1., term = 1.;
+    for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+      term *= (x / (2. * k)) * (x / (2. * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  int64_t m_step;  // input samples per m_den output samples
+  int64_t m_den;
+  int m_half;
+  int m_taps;
+  std::vector<float> m_filters;
+  std::vector<float> m_deltas;
+};
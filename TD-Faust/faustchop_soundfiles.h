@@ -0,0 +1,500 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <faust/gui/SoundUI.h>
+
+#include "faustchop_prefetch.h"
+#include "faustchop_stream.h"
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPSoundfileCache
+// desc: Process-wide cache of decoded soundfiles, shared by every Faust CHOP
+//       and kept across recompiles.
+//
+// Entries are keyed on the canonical path and modification time of each
+// file, the target sample rate and the channel layout, so editing a file or
+// changing the sample rate loads it again. Buffers are handed out as shared
+// pointers and never written to after loading. When the total size exceeds
+// the memory cap, the least recently used entries that no SoundUI holds any
+// more are dropped; entries still in use are never freed from under a DSP.
+//-----------------------------------------------------------------------------
+class FaustCHOPSoundfileCache {
+ public:
+  typedef std::function<std::shared_ptr<Soundfile>()> Loader;
+
+  static FaustCHOPSoundfileCache& instance() {
+    static FaustCHOPSoundfileCache cache;
+    return cache;
+  }
+
+  // Describe the files in `paths` as they are on disk right now. `variant`
+  // tells apart soundfiles made from the same files in different ways.
+  static std::string makeKey(const std::vector<std::string>& paths,
+                             int sampleRate, int maxChannels, bool isDouble,
+                             const std::string& variant = "") {
+    std::string key = variant + std::to_string(sampleRate) + ":" +
+                      std::to_string(maxChannels) + ":" +
+                      (isDouble ? "d" : "f");
+    for (const std::string& path : paths) {
+      std::error_code ec;
+      std::filesystem::path canonical = std::filesystem::canonical(path, ec);
+      int64_t mtime = 0;
+      if (!ec) {
+        mtime = (int64_t)std::filesystem::last_write_time(canonical, ec)
+                    .time_since_epoch()
+                    .count();
+      }
+      key += "|" + (ec ? path : canonical.string()) + "@" +
+             std::to_string(mtime);
+    }
+    return key;
+  }
+
+  // Return the soundfile for `key`, calling `load` if it isn't cached.
+  // Concurrent requests for the same key wait for a single load. Returns
+  // nullptr if loading failed (failures aren't cached).
+  std::shared_ptr<Soundfile> acquire(const std::string& key,
+                                     const Loader& load) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      m_hits++;
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+      std::shared_future<std::shared_ptr<Soundfile>> result =
+          it->second.result;
+      lock.unlock();
+      return result.get();
+    }
+
+    m_misses++;
+    std::promise<std::shared_ptr<Soundfile>> promise;
+    Entry& entry = m_entries[key];
+    entry.result = promise.get_future().share();
+    m_lru.push_front(key);
+    entry.lru = m_lru.begin();
+    lock.unlock();
+
+    std::shared_ptr<Soundfile> soundfile = load();
+    promise.set_value(soundfile);
+
+    lock.lock();
+    it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      if (soundfile) {
+        it->second.ready = true;
+        it->second.bytes = sizeOf(*soundfile);
+        m_bytes += it->second.bytes;
+      } else {
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+      }
+    }
+    evict();
+    return soundfile;
+  }
+
+  // Return the soundfile for `key` if it is loaded, without waiting.
+  std::shared_ptr<Soundfile> find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end() || !it->second.ready) {
+      return nullptr;
+    }
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    return it->second.result.get();
+  }
+
+  void setCapacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = bytes;
+    evict();
+  }
+
+  size_t getBytes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+  }
+
+  size_t getNumEntries() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+  }
+
+  uint64_t getHits() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+  }
+
+  uint64_t getMisses() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+  }
+
+  // Size of the sample memory owned by a soundfile.
+  static size_t sizeOf(const Soundfile& soundfile) {
+    int64_t length = 0;
+    for (int part = 0; part < MAX_SOUNDFILE_PARTS; part++) {
+      length = std::max<int64_t>(
+          length, (int64_t)soundfile.fOffset[part] + soundfile.fLength[part]);
+    }
+    return (size_t)length * soundfile.fChannels *
+           (soundfile.fIsDouble ? sizeof(double) : sizeof(float));
+  }
+
+ private:
+  struct Entry {
+    std::shared_future<std::shared_ptr<Soundfile>> result;
+    std::list<std::string>::iterator lru;
+    bool ready = false;
+    size_t bytes = 0;  // heap memory; memory-mapped soundfiles count as 0
+  };
+
+  FaustCHOPSoundfileCache() = default;
+
+  // Called with m_mutex held.
+  void evict() {
+    for (auto it = m_lru.end(); m_bytes > m_capacity && it != m_lru.begin();) {
+      --it;
+      auto entry = m_entries.find(*it);
+      if (!entry->second.ready ||
+          entry->second.result.get().use_count() > 1) {
+        continue;  // still loading, or still used by a DSP
+      }
+      m_bytes -= entry->second.bytes;
+      m_entries.erase(entry);
+      it = m_lru.erase(it);
+    }
+  }
+
+  std::mutex m_mutex;
+  std::map<std::string, Entry> m_entries;
+  std::list<std::string> m_lru;  // most recently used first
+  size_t m_bytes = 0;
+  size_t m_capacity = (size_t)1 << 31;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPLoaderPool
+// desc: A few worker threads for decoding soundfiles off the cook thread.
+//       Threads are started on the first job. Jobs that haven't started when
+//       the pool is stopped are dropped.
+//-----------------------------------------------------------------------------
+class FaustCHOPLoaderPool {
+ public:
+  explicit FaustCHOPLoaderPool(int numThreads = 0) : m_numThreads(numThreads) {
+    if (m_numThreads <= 0) {
+      m_numThreads =
+          (int)std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+    }
+  }
+
+  ~FaustCHOPLoaderPool() { stop(); }
+
+  void submit(std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_threads.empty()) {
+      m_stopping = false;
+      for (int i = 0; i < m_numThreads; i++) {
+        m_threads.emplace_back([this]() { run(); });
+      }
+    }
+    m_jobs.push_back(std::move(job));
+    m_wake.notify_one();
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+      m_jobs.clear();
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads) {
+      thread.join();
+    }
+    m_threads.clear();
+  }
+
+ private:
+  void run() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+        if (m_stopping) {
+          return;
+        }
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+      }
+      job();
+    }
+  }
+
+  int m_numThreads;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<std::function<void()>> m_jobs;
+  std::vector<std::thread> m_threads;
+  bool m_stopping = false;
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPSoundUI
+// desc: SoundUI that gets its soundfiles from FaustCHOPSoundfileCache, so
+//       recompiling a DSP, or running several copies of it, reuses the
+//       buffers that are already in memory.
+//
+// With streaming enabled, soundfiles are played from memory-mapped banks
+// (see FaustCHOPStream) instead of being decoded into memory. With a stream
+// sample rate, they are converted to that rate through the same banks. A url
+// naming an .fcsb bank is always mapped directly.
+//
+// Given a loader pool, soundfiles that aren't cached yet are decoded in the
+// background. Their zones point to the silent `defaultsound` until
+// swapLoaded(), called on the cook thread between two compute() calls,
+// switches them to the real buffer.
+//
+// Given a prefetcher, streamed soundfiles are read ahead of the voices
+// playing them (see FaustCHOPPrefetcher).
+//-----------------------------------------------------------------------------
+class FaustCHOPSoundUI : public SoundUI {
+ public:
+  FaustCHOPSoundUI(const std::string& soundDirectory, int sampleRate,
+                   FaustCHOPLoaderPool* pool = nullptr,
+                   const FaustCHOPStream::Settings& stream = {},
+                   FaustCHOPPrefetcher* prefetcher = nullptr)
+      : SoundUI(soundDirectory, sampleRate),
+        m_sampleRate(sampleRate),
+        m_pool(pool),
+        m_stream(stream),
+        m_prefetcher(prefetcher),
+        m_loads(std::make_shared<Loads>()) {}
+
+  void addSoundfile(const char* label, const char* url,
+                    Soundfile** sf_zone) override {
+    if (isBank(url)) {
+      addBank(url, sf_zone);
+      return;
+    }
+
+    std::vector<std::string> paths = resolve(url);
+    std::string key = FaustCHOPSoundfileCache::makeKey(
+        paths, m_sampleRate, MAX_CHAN, fIsDouble,
+        std::string(m_stream.enabled ? "stream:" : "") +
+            (m_stream.sampleRate ? "resample:" : ""));
+    FaustCHOPSoundfileCache& cache = FaustCHOPSoundfileCache::instance();
+
+    std::shared_ptr<Soundfile> soundfile = cache.find(key);
+    if (soundfile) {
+      use(key, soundfile, sf_zone);
+      return;
+    }
+
+    if (m_pool) {
+      *sf_zone = defaultsound;
+      auto waiting = m_waiting.find(key);
+      if (waiting != m_waiting.end()) {
+        waiting->second.push_back(sf_zone);
+        return;
+      }
+      m_waiting[key].push_back(sf_zone);
+      m_numTotal++;
+
+      std::shared_ptr<Loads> loads = m_loads;
+      FaustCHOPSoundfileCache::Loader loader = makeLoader(paths);
+      std::string name = url;
+      m_pool->submit([loads, loader, key, name]() {
+        std::shared_ptr<Soundfile> loaded =
+            FaustCHOPSoundfileCache::instance().acquire(key, loader);
+        std::lock_guard<std::mutex> lock(loads->mutex);
+        loads->done.push_back({key, name, loaded});
+      });
+      return;
+    }
+
+    soundfile = cache.acquire(key, makeLoader(paths));
+    if (!soundfile) {
+      fail(url, sf_zone);
+      return;
+    }
+    use(key, soundfile, sf_zone);
+  }
+
+  // Cook thread, outside of compute(). Point the zones of every soundfile
+  // that finished loading to its buffer. Doesn't wait if a loader thread
+  // holds the lock; the swap then happens on a later cook.
+  void swapLoaded() {
+    std::unique_lock<std::mutex> lock(m_loads->mutex, std::try_to_lock);
+    if (!lock.owns_lock() || m_loads->done.empty()) {
+      return;
+    }
+    std::vector<Loaded> done;
+    done.swap(m_loads->done);
+    lock.unlock();
+
+    for (const Loaded& loaded : done) {
+      std::vector<Soundfile**> zones;
+      zones.swap(m_waiting[loaded.key]);
+      m_waiting.erase(loaded.key);
+      m_numLoaded++;
+      for (Soundfile** zone : zones) {
+        if (loaded.soundfile) {
+          use(loaded.key, loaded.soundfile, zone);
+        } else {
+          fail(loaded.name.c_str(), zone);
+        }
+      }
+    }
+  }
+
+  // Soundfiles decoded in the background by this UI.
+  int getNumTotal() const { return m_numTotal; }
+  int getNumLoaded() const { return m_numLoaded; }
+  int getNumPending() const { return m_numTotal - m_numLoaded; }
+
+ protected:
+  struct Loaded {
+    std::string key;
+    std::string name;
+    std::shared_ptr<Soundfile> soundfile;
+  };
+
+  // Shared with the loader jobs, which may outlive the UI.
+  struct Loads {
+    std::mutex mutex;
+    std::vector<Loaded> done;
+  };
+
+  // Captures everything by value: it may run on a loader thread after this
+  // UI is gone.
+  FaustCHOPSoundfileCache::Loader makeLoader(
+      const std::vector<std::string>& paths) {
+    SoundfileReader* reader = fSoundReader;
+    bool isDouble = fIsDouble;
+    if (m_stream.enabled || m_stream.sampleRate) {
+      // Banks on disk don't depend on whether they are streamed.
+      std::string key = FaustCHOPSoundfileCache::makeKey(
+          paths, m_stream.sampleRate, MAX_CHAN, isDouble, "bank:");
+      FaustCHOPStream::Settings stream = m_stream;
+      return [paths, key, isDouble, stream]() {
+        return FaustCHOPStream::load(paths, key, isDouble, stream);
+      };
+    }
+    return [paths, reader, isDouble]() {
+      return std::shared_ptr<Soundfile>(
+          reader->createSoundfile(paths, MAX_CHAN, isDouble));
+    };
+  }
+
+  void use(const std::string& key, const std::shared_ptr<Soundfile>& soundfile,
+           Soundfile** sf_zone) {
+    // Holding the pointer keeps the buffer alive for as long as this UI,
+    // and therefore the DSP, exists.
+    std::shared_ptr<Soundfile>& held = fSoundfileMap[key];
+    if (m_prefetcher && m_stream.enabled && held != soundfile) {
+      m_prefetcher->add(soundfile, m_stream.preloadFrames, m_sampleRate);
+    }
+    held = soundfile;
+    *sf_zone = soundfile.get();
+  }
+
+  static bool isBank(const std::string& url) {
+    return url.size() > 5 && url.compare(url.size() - 5, 5, ".fcsb") == 0;
+  }
+
+  // A prepared bank (such as a wavetable bank made by
+  // assets/make_wavetable_bank.py) is played straight from its mapping.
+  // Mapping is cheap, so it never goes through the loader pool, and every
+  // DSP using the file shares the same pages.
+  void addBank(const char* url, Soundfile** sf_zone) {
+    std::string path = find(url);
+    if (path.empty()) {
+      fail(url, sf_zone);
+      return;
+    }
+    std::string key = FaustCHOPSoundfileCache::makeKey({path}, 0, MAX_CHAN,
+                                                       fIsDouble, "bank:");
+    bool isDouble = fIsDouble;
+    std::shared_ptr<Soundfile> soundfile =
+        FaustCHOPSoundfileCache::instance().acquire(key, [path, isDouble]() {
+          return FaustCHOPBank::open(path, "", isDouble);
+        });
+    if (!soundfile) {
+      fail(url, sf_zone);
+      return;
+    }
+    use(key, soundfile, sf_zone);
+  }
+
+  static void fail(const char* url, Soundfile** sf_zone) {
+    std::cerr << "addSoundfile : soundfile for " << url
+              << " cannot be created !" << std::endl;
+    *sf_zone = defaultsound;
+  }
+
+  // Full paths of the files in `url`, which is a file name or a
+  // {'a.wav';'b.wav'} list. Paths are looked up with a stat only, so a
+  // cached soundfile costs no file reads; if a file can't be found that
+  // way, the reader's own lookup decides.
+  std::vector<std::string> resolve(const char* url) {
+    std::vector<std::string> names;
+    const char* list = url;
+    if (!parseMenuList2(list, names, true)) {
+      names.push_back(url);
+    }
+
+    std::vector<std::string> paths;
+    for (const std::string& name : names) {
+      std::string path = find(name);
+      if (path.empty()) {
+        return fSoundReader->checkFiles(fSoundfileDir, names);
+      }
+      paths.push_back(path);
+    }
+    return paths;
+  }
+
+  std::string find(const std::string& name) {
+    std::error_code ec;
+    if (std::filesystem::path(name).is_absolute()) {
+      return std::filesystem::is_regular_file(name, ec) ? name : "";
+    }
+    for (const std::string& dir : fSoundfileDir) {
+      std::filesystem::path path = std::filesystem::path(dir) / name;
+      if (std::filesystem::is_regular_file(path, ec)) {
+        return path.string();
+      }
+    }
+    return "";
+  }
+
+  int m_sampleRate;
+  FaustCHOPLoaderPool* m_pool;
+  FaustCHOPStream::Settings m_stream;
+  FaustCHOPPrefetcher* m_prefetcher;
+  std::shared_ptr<Loads> m_loads;
+  std::map<std::string, std::vector<Soundfile**>> m_waiting;
+  int m_numTotal = 0;
+  int m_numLoaded = 0;
+};
@@ -0,0 +1,440 @@
+#pragma once
+
+#include <sndfile.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <libproc.h>
+#include <sys/resource.h>
+#elif !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "faustchop_bank.h"
+#include "faustchop_resample.h"
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPStream
+// desc: Streaming soundfiles for sample libraries larger than RAM.
+//
+// The Faust soundfile primitive reads a Soundfile's buffers directly, so it
+// can't ask for samples ahead of time. Instead, the files of a soundfile are
+// decoded once into a FaustCHOPBank in the stream cache directory and played
+// straight from a memory mapping. The first `preloadFrames` of every part
+// are read in and locked in memory when the soundfile is loaded; the rest is
+// paged in by the OS, with sequential read-ahead, as voices play through it,
+// and dropped again under memory pressure. Heads past the OS's limit on
+// locked memory are only read in, counted in getUnlockedBytes(), and can be
+// dropped like the rest. A voice that reaches a page that isn't resident
+// yet stalls the cook on a major page fault, which is what counts as an
+// underrun. FaustCHOPPrefetcher reads ahead of the voices to keep that from
+// happening.
+//
+// The same banks hold soundfiles converted to the DSP's sample rate (see
+// FaustCHOPResampler). Those are converted once per rate and, when not
+// streamed, read back into memory, so later loads at that rate skip the
+// conversion.
+//
+// A bank is named after a hash of its key, so a bank whose source files
+// changed is simply never opened again. To keep the cache directory from
+// growing without end, every bank is touched when it is used, and after a
+// conversion the least recently used ones are deleted until the directory
+// fits in `cacheBytes`. Banks whose soundfiles are still loaded, in
+// FaustCHOPSoundfileCache or a Faust CHOP, are never deleted.
+//-----------------------------------------------------------------------------
+class FaustCHOPStream {
+ public:
+  struct Settings {
+    bool enabled = false;
+    std::string cacheDir;   // empty: a TD-Faust folder in the temp directory
+    int preloadFrames = 0;  // resident head of every part
+    int sampleRate = 0;     // convert every part to this rate; 0: keep rates
+    uint64_t cacheBytes = 0;  // disk budget of cacheDir; 0: no limit
+  };
+
+  // Loader for FaustCHOPSoundfileCache. `key` identifies the source files
+  // and the target sample rate (see FaustCHOPSoundfileCache::makeKey). The
+  // soundfile is mapped if streaming is enabled, and read into memory
+  // otherwise.
+  static std::shared_ptr<Soundfile> load(const std::vector<std::string>& paths,
+                                         const std::string& key, bool isDouble,
+                                         const Settings& settings) {
+    std::error_code ec;
+    std::filesystem::path dir =
+        settings.cacheDir.empty()
+            ? std::filesystem::temp_directory_path(ec) / "TD-Faust" / "stream"
+            : std::filesystem::path(settings.cacheDir);
+    std::filesystem::create_directories(dir, ec);
+    const std::string name = hash(key) + ".fcsb";
+    const std::string path = (dir / name).string();
+
+    std::shared_ptr<FaustCHOPMappedFile> mapping;
+    auto open = [&]() {
+      return settings.enabled
+                 ? FaustCHOPBank::open(path, key, isDouble, &mapping)
+                 : FaustCHOPBank::read(path, key, isDouble);
+    };
+    // From here on, prune() leaves the bank alone.
+    claim(name);
+    std::shared_ptr<Soundfile> soundfile = open();
+    const bool converting = !soundfile;
+    if (converting) {
+      // Unique, since other threads and processes may be converting the
+      // same files into the same directory.
+      std::random_device random;
+      char suffix[32];
+      snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", (unsigned)random(),
+               (unsigned)random());
+      const std::string temp = path + suffix;
+      bool converted =
+          isDouble ? convert<double>(paths, temp, key, settings.sampleRate)
+                   : convert<float>(paths, temp, key, settings.sampleRate);
+      if (converted) {
+        std::filesystem::rename(temp, path, ec);
+      }
+      if (!converted || ec) {
+        // If the rename failed, most likely another converter got there
+        // first (Windows doesn't replace a bank that is open), and its bank
+        // is just as good.
+        std::filesystem::remove(temp, ec);
+      }
+      soundfile = open();
+    } else {
+      // Most recently used
+      std::filesystem::last_write_time(
+          path, std::filesystem::file_time_type::clock::now(), ec);
+    }
+    if (!soundfile) {
+      release(name);
+      return nullptr;
+    }
+    const uint64_t unlocked =
+        mapping ? preload(*soundfile, *mapping, settings.preloadFrames,
+                          isDouble)
+                : 0;
+    soundfile = inUse(soundfile, name, unlocked);
+    if (converting && settings.cacheBytes) {
+      prune(dir, settings.cacheBytes);
+    }
+    return soundfile;
+  }
+
+  // Bytes of the heads of loaded soundfiles, across the process, that the
+  // OS wouldn't lock in memory.
+  static uint64_t getUnlockedBytes() { return unlockedBytes().load(); }
+
+  // Major page faults taken by the calling thread so far, or -1 where the
+  // OS doesn't report them per thread (macOS reports the whole process).
+  static int64_t majorFaults() {
+#ifdef _WIN32
+    return -1;
+#elif defined(__APPLE__)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_majflt : -1;
+#else
+    struct rusage usage;
+    return getrusage(RUSAGE_THREAD, &usage) == 0 ? usage.ru_majflt : -1;
+#endif
+  }
+
+  // Bytes this process has read from storage so far, or -1.
+  static int64_t diskReadBytes() {
+#ifdef _WIN32
+    IO_COUNTERS counters;
+    return GetProcessIoCounters(GetCurrentProcess(), &counters)
+               ? (int64_t)counters.ReadTransferCount
+               : -1;
+#elif defined(__APPLE__)
+    rusage_info_v2 info;
+    return proc_pid_rusage(getpid(), RUSAGE_INFO_V2, (rusage_info_t*)&info) == 0
+               ? (int64_t)info.ri_diskio_bytesread
+               : -1;
+#else
+    std::ifstream io("/proc/self/io");
+    std::string name;
+    int64_t value;
+    while (io >> name >> value) {
+      if (name == "read_bytes:") {
+        return value;
+      }
+    }
+    return -1;
+#endif
+  }
+
+ private:
+  static const int kChunkFrames = 65536;
+
+  // 64-bit FNV-1a, stable across runs and builds.
+  static std::string hash(const std::string& key) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key) {
+      h = (h ^ c) * 1099511628211ull;
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    return hex;
+  }
+
+  static sf_count_t read(SNDFILE* file, float* buffer, sf_count_t frames) {
+    return sf_readf_float(file, buffer, frames);
+  }
+
+  static sf_count_t read(SNDFILE* file, double* buffer, sf_count_t frames) {
+    return sf_readf_double(file, buffer, frames);
+  }
+
+  // Serializes counting banks in use and pruning the cache directory,
+  // across every Faust CHOP in the process.
+  static std::mutex& pruneMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  // File names of the banks whose soundfiles are loaded, or being loaded,
+  // with how many times each is. With pruneMutex() held.
+  static std::map<std::string, int>& banksInUse() {
+    static std::map<std::string, int> banks;
+    return banks;
+  }
+
+  static void claim(const std::string& name) {
+    std::lock_guard<std::mutex> lock(pruneMutex());
+    banksInUse()[name]++;
+  }
+
+  static void release(const std::string& name) {
+    std::lock_guard<std::mutex> lock(pruneMutex());
+    auto it = banksInUse().find(name);
+    if (it != banksInUse().end() && --it->second == 0) {
+      banksInUse().erase(it);
+    }
+  }
+
+  static std::atomic<uint64_t>& unlockedBytes() {
+    static std::atomic<uint64_t> bytes{0};
+    return bytes;
+  }
+
+  // `soundfile`, from the claimed bank `name`, which is released once the
+  // last reference to the soundfile is gone. `unlocked` bytes of its heads
+  // count in getUnlockedBytes() until then.
+  static std::shared_ptr<Soundfile> inUse(std::shared_ptr<Soundfile> soundfile,
+                                          const std::string& name,
+                                          uint64_t unlocked) {
+    unlockedBytes() += unlocked;
+    Soundfile* raw = soundfile.get();
+    return std::shared_ptr<Soundfile>(
+        raw, [soundfile = std::move(soundfile), name,
+              unlocked](Soundfile*) mutable {
+          unlockedBytes() -= unlocked;
+          release(name);
+          soundfile.reset();
+        });
+  }
+
+  // Delete the least recently used banks in `dir`, oldest first, until the
+  // banks fit in `budget` bytes. Banks in use stay even if they alone are
+  // over budget.
+  static void prune(const std::filesystem::path& dir, uint64_t budget) {
+    std::lock_guard<std::mutex> lock(pruneMutex());
+    struct Bank {
+      std::filesystem::file_time_type time;
+      uint64_t size;
+      std::filesystem::path path;
+    };
+    std::vector<Bank> banks;
+    uint64_t total = 0;
+    const std::map<std::string, int>& used = banksInUse();
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(dir, ec), end;
+         !ec && it != end; it.increment(ec)) {
+      if (it->path().extension() != ".fcsb") {
+        continue;
+      }
+      std::error_code sizeError, timeError;
+      const uint64_t size = it->file_size(sizeError);
+      const auto time = it->last_write_time(timeError);
+      if (sizeError || timeError) {
+        continue;
+      }
+      total += size;
+      if (!used.count(it->path().filename().string())) {
+        banks.push_back({time, size, it->path()});
+      }
+    }
+    std::sort(banks.begin(), banks.end(),
+              [](const Bank& a, const Bank& b) { return a.time < b.time; });
+    for (const Bank& bank : banks) {
+      if (total <= budget) {
+        break;
+      }
+      // Fails on Windows while another process has the bank mapped.
+      if (std::filesystem::remove(bank.path, ec)) {
+        total -= bank.size;
+      }
+    }
+  }
+
+  // Decode `paths` into a bank at `path`, resampling parts to `sampleRate`
+  // unless it is 0. Files that can't be opened become silent parts, as with
+  // Faust's own reader. load() writes to a temporary file and renames it
+  // so that an interrupted conversion is never mistaken for a bank.
+  template <typename REAL>
+  static bool convert(const std::vector<std::string>& paths,
+                      const std::string& path, const std::string& key,
+                      int sampleRate) {
+    std::vector<FaustCHOPBank::Part> parts;
+    std::vector<bool> present;
+    uint32_t channels = 1;
+    for (const std::string& file : paths) {
+      SF_INFO info = {};
+      SNDFILE* sf = file.empty() ? nullptr
+                                 : sf_open(file.c_str(), SFM_READ, &info);
+      if (sf && sampleRate > 0 && info.samplerate > 0 &&
+          info.samplerate != sampleRate) {
+        info.frames = FaustCHOPResampler(info.samplerate, sampleRate)
+                          .outputLength(info.frames);
+        info.samplerate = sampleRate;
+      }
+      if (sf && info.frames <= INT32_MAX) {
+        parts.push_back({0, (int32_t)info.frames, info.samplerate});
+        channels = std::max(channels, (uint32_t)info.channels);
+        present.push_back(true);
+      } else {
+        parts.push_back({0, BUFFER_SIZE, SAMPLE_RATE});
+        present.push_back(false);
+      }
+      if (sf) {
+        sf_close(sf);
+      }
+    }
+    if (parts.empty() || parts.size() > MAX_SOUNDFILE_PARTS ||
+        channels > MAX_CHAN) {
+      return false;
+    }
+
+    FaustCHOPBank::Writer writer;
+    if (!writer.create(path, channels, sizeof(REAL), parts, key)) {
+      return false;
+    }
+
+    std::vector<REAL> buffer, channel, resampled;
+    for (size_t part = 0; part < paths.size(); part++) {
+      if (!present[part]) {
+        continue;
+      }
+      SF_INFO info = {};
+      SNDFILE* sf = sf_open(paths[part].c_str(), SFM_READ, &info);
+      if (!sf) {
+        continue;
+      }
+      const int64_t length = parts[part].length;
+      std::unique_ptr<FaustCHOPResampler> resampler;
+      std::vector<FaustCHOPResampler::Channel<REAL>> resamplers;
+      if (info.samplerate != parts[part].sampleRate) {
+        resampler = std::make_unique<FaustCHOPResampler>(
+            info.samplerate, parts[part].sampleRate);
+        for (int chan = 0; chan < info.channels; chan++) {
+          resamplers.emplace_back(*resampler, length);
+        }
+      }
+
+      // Write `count` samples of channel `chan`, past what was already
+      // written to it.
+      std::vector<int64_t> written(info.channels, 0);
+      auto write = [&](int chan, const REAL* samples, size_t count) {
+        count = (size_t)std::min<int64_t>(count, length - written[chan]);
+        std::copy(samples, samples + count,
+                  (REAL*)writer.samples(chan, (uint32_t)part) + written[chan]);
+        written[chan] += count;
+      };
+
+      buffer.resize((size_t)kChunkFrames * info.channels);
+      channel.resize(kChunkFrames);
+      sf_count_t frames;
+      while ((frames = read(sf, buffer.data(), kChunkFrames)) > 0) {
+        for (int chan = 0; chan < info.channels; chan++) {
+          for (sf_count_t i = 0; i < frames; i++) {
+            channel[i] = buffer[i * info.channels + chan];
+          }
+          if (resampler) {
+            resampled.clear();
+            resamplers[chan].push(channel.data(), (size_t)frames, resampled);
+            write(chan, resampled.data(), resampled.size());
+          } else {
+            write(chan, channel.data(), (size_t)frames);
+          }
+        }
+      }
+      for (size_t chan = 0; chan < resamplers.size(); chan++) {
+        resampled.clear();
+        resamplers[chan].finish(resampled);
+        write((int)chan, resampled.data(), resampled.size());
+      }
+      sf_close(sf);
+    }
+    writer.close();
+    return true;
+  }
+
+  // Lock the head of every part in memory and hint sequential access for
+  // the rest. The sequential hint lets the OS drop pages soon after they
+  // are read, so it stays off the heads. Returns the bytes of heads that
+  // couldn't be locked.
+  template <typename REAL>
+  static uint64_t preloadChannels(const Soundfile& soundfile,
+                              FaustCHOPMappedFile& mapping, int frames) {
+    // Channels past the real ones share their buffers.
+    std::set<REAL*> channels(static_cast<REAL**>(soundfile.fBuffers),
+                             static_cast<REAL**>(soundfile.fBuffers) + MAX_CHAN);
+    volatile REAL sink = 0;
+    const int stride = 4096 / sizeof(REAL);
+    uint64_t unlocked = 0;
+    for (REAL* channel : channels) {
+      for (int part = 0; part < soundfile.fParts; part++) {
+        REAL* start = channel + soundfile.fOffset[part];
+        const uint64_t offset = (uint64_t)((char*)start - mapping.data());
+        const int length =
+            std::max(0, std::min(frames, soundfile.fLength[part]));
+        const uint64_t headBytes = (uint64_t)length * sizeof(REAL);
+        const uint64_t tailBytes =
+            (uint64_t)(soundfile.fLength[part] - length) * sizeof(REAL);
+        mapping.advise(offset + headBytes, tailBytes,
+                       FaustCHOPMappedFile::kSequential);
+        if (length == 0) {
+          continue;
+        }
+        // Locking reads the pages in. Past the limit, read them in anyway.
+        if (!mapping.lock(offset, headBytes)) {
+          unlocked += headBytes;
+          mapping.advise(offset, headBytes, FaustCHOPMappedFile::kWillNeed);
+          for (int i = 0; i < length; i += stride) {
+            sink = sink + start[i];
+          }
+        }
+      }
+    }
+    return unlocked;
+  }
+
+  static uint64_t preload(const Soundfile& soundfile,
+                          FaustCHOPMappedFile& mapping, int frames,
+                          bool isDouble) {
+    return isDouble ? preloadChannels<double>(soundfile, mapping, frames)
+                    : preloadChannels<float>(soundfile, mapping, frames);
+  }
+};
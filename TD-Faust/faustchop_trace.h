@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPTrace
+// desc: Process-wide recorder of timed events, written out in the Chrome
+//       trace event format so the cooks of every traced Faust CHOP can be
+//       laid out on one timeline in ui.perfetto.dev or chrome://tracing.
+//
+// Each thread records into its own fixed-size ring buffer: an event costs
+// a clock read and a few stores, without locks or allocation, and the
+// oldest events are overwritten once the buffer is full. Event names, node
+// paths and argument names are kept as pointers, so they must be string
+// literals or interned.
+//-----------------------------------------------------------------------------
+class FaustCHOPTrace {
+ public:
+  // Events per thread, about 3 MB
+  static const int kCapacity = 1 << 16;
+
+  static FaustCHOPTrace& instance() {
+    static FaustCHOPTrace trace;
+    return trace;
+  }
+
+  // A copy of `name` that lives as long as the process.
+  const char* intern(const char* name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_names.insert(name).first->c_str();
+  }
+
+  // Nanoseconds since the process started tracing
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - m_epoch)
+        .count();
+  }
+
+  // Records a complete event of the calling thread. `argName` may be null.
+  void record(const char* name, const char* node, int64_t beginNs,
+              int64_t endNs, const char* argName, int64_t arg) {
+    Buffer& buffer = threadBuffer();
+    const uint64_t written = buffer.written.load(std::memory_order_relaxed);
+    // dump() must see the last count before it can see this event's fields.
+    std::atomic_thread_fence(std::memory_order_release);
+    buffer.slots[written % kCapacity].store(
+        {name, node, argName, beginNs, endNs - beginNs, arg});
+    buffer.written.store(written + 1, std::memory_order_release);
+  }
+
+  // Writes the events of every thread to `path` as trace JSON. The buffers
+  // are left as they are, so a later dump includes these events again.
+  bool dump(const std::string& path, std::string& error) {
+    std::vector<Buffer*> buffers;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (const auto& buffer : m_buffers) {
+        buffers.push_back(buffer.get());
+      }
+    }
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+      error = "Could not open " + path + " for writing";
+      return false;
+    }
+    fprintf(file,
+            "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"args\":{\"name\":\"Faust CHOP\"}}");
+
+    std::vector<Event> events;
+    for (size_t tid = 1; tid <= buffers.size(); tid++) {
+      fprintf(file,
+              ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+              "\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+              tid, tid);
+
+      // The owning thread may keep recording while its events are copied:
+      // any that it could have started overwriting in the meantime are
+      // dropped.
+      const Buffer& buffer = *buffers[tid - 1];
+      const uint64_t end = buffer.written.load(std::memory_order_acquire);
+      const uint64_t begin = end > kCapacity ? end - kCapacity : 0;
+      events.clear();
+      for (uint64_t i = begin; i < end; i++) {
+        events.push_back(buffer.slots[i % kCapacity].load());
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint64_t after = buffer.written.load(std::memory_order_relaxed);
+      const uint64_t valid = after >= kCapacity ? after + 1 - kCapacity : 0;
+
+      for (uint64_t i = std::max(begin, valid); i < end; i++) {
+        const Event& event = events[i - begin];
+        fprintf(file,
+                ",\n{\"name\":\"%s\",\"cat\":\"faust\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu,"
+                "\"args\":{\"node\":\"%s\"",
+                escape(event.name).c_str(), event.beginNs / 1e3,
+                event.durationNs / 1e3, tid, escape(event.node).c_str());
+        if (event.argName) {
+          fprintf(file, ",\"%s\":%lld", escape(event.argName).c_str(),
+                  (long long)event.arg);
+        }
+        fprintf(file, "}}");
+      }
+    }
+
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+      error = "Could not write " + path;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  struct Event {
+    const char* name;
+    const char* node;
+    const char* argName;
+    int64_t beginNs;
+    int64_t durationNs;
+    int64_t arg;
+  };
+
+  // Relaxed atomics, so that dump() can read them while they are written.
+  // They compile to plain loads and stores.
+  struct Slot {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<const char*> node{nullptr};
+    std::atomic<const char*> argName{nullptr};
+    std::atomic<int64_t> beginNs{0};
+    std::atomic<int64_t> durationNs{0};
+    std::atomic<int64_t> arg{0};
+
+    void store(const Event& event) {
+      name.store(event.name, std::memory_order_relaxed);
+      node.store(event.node, std::memory_order_relaxed);
+      argName.store(event.argName, std::memory_order_relaxed);
+      beginNs.store(event.beginNs, std::memory_order_relaxed);
+      durationNs.store(event.durationNs, std::memory_order_relaxed);
+      arg.store(event.arg, std::memory_order_relaxed);
+    }
+
+    Event load() const {
+      return {name.load(std::memory_order_relaxed),
+              node.load(std::memory_order_relaxed),
+              argName.load(std::memory_order_relaxed),
+              beginNs.load(std::memory_order_relaxed),
+              durationNs.load(std::memory_order_relaxed),
+              arg.load(std::memory_order_relaxed)};
+    }
+  };
+
+  struct Buffer {
+    std::unique_ptr<Slot[]> slots{new Slot[kCapacity]};
+    std::atomic<uint64_t> written{0};
+  };
+
+  FaustCHOPTrace() : m_epoch(std::chrono::steady_clock::now()) {}
+
+  // Buffers are created the first time a thread records, and kept after it
+  // exits so that its events can still be dumped.
+  Buffer& threadBuffer() {
+    thread_local Buffer* buffer = nullptr;
+    if (!buffer) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_buffers.push_back(std::make_unique<Buffer>());
+      buffer = m_buffers.back().get();
+    }
+    return *buffer;
+  }
+
+  static std::string escape(const char* text) {
+    std::string escaped;
+    for (const char* c = text ? text : ""; *c; c++) {
+      if (*c == '"' || *c == '\\') {
+        escaped += '\\';
+        escaped += *c;
+      } else if ((unsigned char)*c < 0x20) {
+        char code[8];
+        snprintf(code, sizeof(code), "\\u%04x", (unsigned char)*c);
+        escaped += code;
+      } else {
+        escaped += *c;
+      }
+    }
+    return escaped;
+  }
+
+  const std::chrono::steady_clock::time_point m_epoch;
+  std::mutex m_mutex;
+  std::set<std::string> m_names;
+  std::vector<std::unique_ptr<Buffer>> m_buffers;
+};
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPTraceScope
+// desc: Records the lifetime of a scope as a trace event of `node`, or does
+//       nothing at all if `node` is null, which is how tracing is turned off.
+//-----------------------------------------------------------------------------
+class FaustCHOPTraceScope {
+ public:
+  FaustCHOPTraceScope(const char* node, const char* name,
+                      const char* argName = nullptr, int64_t arg = 0)
+      : m_node(node),
+        m_name(name),
+        m_argName(argName),
+        m_arg(arg),
+        m_beginNs(node ? FaustCHOPTrace::instance().now() : 0) {}
+
+  ~FaustCHOPTraceScope() {
+    if (m_node) {
+      FaustCHOPTrace& trace = FaustCHOPTrace::instance();
+      trace.record(m_name, m_node, m_beginNs, trace.now(), m_argName, m_arg);
+    }
+  }
+
+  FaustCHOPTraceScope(const FaustCHOPTraceScope&) = delete;
+  FaustCHOPTraceScope& operator=(const FaustCHOPTraceScope&) = delete;
+
+  // For arguments only known at the end of the scope
+  void setArg(int64_t arg) { m_arg = arg; }
+
+ private:
+  const char* m_node;
+  const char* m_name;
+  const char* m_argName;
+  int64_t m_arg;
+  int64_t m_beginNs;
+};
@@ -6,9 +6,11 @@
 #include "GL_Extensions.h"
 
 #define DLLEXPORT __declspec(dllexport)
-#else
+#elif defined(__APPLE__)
 #include <OpenGL/gltypes.h>
 #define DLLEXPORT
+#else
+#define DLLEXPORT
 #endif
 
 #include <iostream>
@@ -96,6 +98,20 @@ class FaustCHOPUI : public APIUI {
 
   int getNumBarGraphs() { return m_mapIntToAddress.size(); }
 
+  // Full paths and zones of the bargraphs, or of every other parameter, in
+  // the order they were added.
+  void getZones(bool bargraphs, std::vector<std::string>& paths,
+                std::vector<FAUSTFLOAT*>& zones) {
+    for (const auto& item : fItems) {
+      bool isBargraph =
+          item.fItemType == kVBargraph || item.fItemType == kHBargraph;
+      if (isBargraph == bargraphs) {
+        paths.push_back(item.fPath);
+        zones.push_back(item.fZone);
+      }
+    }
+  }
+
  private:
   std::map<int, std::string> m_mapIntToAddress;
 };
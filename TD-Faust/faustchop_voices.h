@@ -0,0 +1,174 @@
+#pragma once
+
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPVoiceAllocator
+// desc: O(1) polyphonic voice bookkeeping: a free list, a pitch -> voice map
+//       and least-recently-used lists for voice stealing.
+//
+// A new note takes, in order of preference:
+//   1. a free voice,
+//   2. the voice that was released the longest time ago,
+//   3. the voice that started playing the longest time ago (stolen).
+// A note off releases the oldest voice still holding that pitch.
+//-----------------------------------------------------------------------------
+class FaustCHOPVoiceAllocator {
+ public:
+  enum State { kFree = 0, kPlaying, kReleased };
+
+  static const int kNumPitches = 128;
+  static const int kNone = -1;
+
+  explicit FaustCHOPVoiceAllocator(int numVoices = 0) { resize(numVoices); }
+
+  // Forget every note and mark all voices as free.
+  void resize(int numVoices) {
+    m_voices.assign(numVoices, Voice());
+    m_free.clear();
+    m_free.reserve(numVoices);
+    // Pop from the back so that voice 0 is handed out first.
+    for (int v = numVoices - 1; v >= 0; v--) {
+      m_free.push_back(v);
+    }
+    m_playing = List();
+    m_released = List();
+    for (auto& chain : m_pitches) {
+      chain = List();
+    }
+  }
+
+  void reset() { resize((int)m_voices.size()); }
+
+  // Pick a voice for `pitch`. `previous` receives the state the voice was
+  // in: kReleased or kPlaying when it is taken from another note.
+  int noteOn(int pitch, State& previous) {
+    previous = kFree;
+    if (m_voices.empty() || pitch < 0 || pitch >= kNumPitches) {
+      return kNone;
+    }
+
+    int v;
+    if (!m_free.empty()) {
+      v = m_free.back();
+      m_free.pop_back();
+    } else if (m_released.head != kNone) {
+      v = m_released.head;
+      unlink(m_released, v, &Voice::lru);
+    } else {
+      v = m_playing.head;
+      unlink(m_playing, v, &Voice::lru);
+      unlink(m_pitches[m_voices[v].pitch], v, &Voice::chain);
+    }
+
+    Voice& voice = m_voices[v];
+    previous = voice.state;
+    voice.state = kPlaying;
+    voice.pitch = pitch;
+    append(m_playing, v, &Voice::lru);
+    append(m_pitches[pitch], v, &Voice::chain);
+    return v;
+  }
+
+  // Release the oldest voice playing `pitch`. Returns kNone if there isn't one.
+  int noteOff(int pitch) {
+    if (pitch < 0 || pitch >= kNumPitches) {
+      return kNone;
+    }
+    int v = m_pitches[pitch].head;
+    if (v != kNone) {
+      release(v);
+    }
+    return v;
+  }
+
+  // Move every playing voice to the released list, oldest first.
+  void releaseAll() {
+    while (m_playing.head != kNone) {
+      release(m_playing.head);
+    }
+  }
+
+  // The voice has finished its release and can be reused right away.
+  void free(int v) {
+    if (m_voices[v].state == kReleased) {
+      unlink(m_released, v, &Voice::lru);
+      m_voices[v].state = kFree;
+      m_free.push_back(v);
+    }
+  }
+
+  // Released voices, oldest first, for callers that poll for silence.
+  template <class F>
+  void forEachReleased(F f) const {
+    for (int v = m_released.head; v != kNone;) {
+      int next = m_voices[v].lru.next;
+      f(v);
+      v = next;
+    }
+  }
+
+  State state(int v) const { return m_voices[v].state; }
+  int pitch(int v) const { return m_voices[v].pitch; }
+  int size() const { return (int)m_voices.size(); }
+  int numFree() const { return (int)m_free.size(); }
+
+ private:
+  struct Link {
+    int prev = kNone;
+    int next = kNone;
+  };
+
+  struct Voice {
+    State state = kFree;
+    int pitch = kNone;
+    Link lru;    // position in the playing or released list
+    Link chain;  // position in the list of voices sharing a pitch
+  };
+
+  struct List {
+    int head = kNone;
+    int tail = kNone;
+  };
+
+  void release(int v) {
+    Voice& voice = m_voices[v];
+    unlink(m_playing, v, &Voice::lru);
+    unlink(m_pitches[voice.pitch], v, &Voice::chain);
+    voice.state = kReleased;
+    append(m_released, v, &Voice::lru);
+  }
+
+  void append(List& list, int v, Link Voice::*link) {
+    Link& l = m_voices[v].*link;
+    l.prev = list.tail;
+    l.next = kNone;
+    if (list.tail != kNone) {
+      (m_voices[list.tail].*link).next = v;
+    } else {
+      list.head = v;
+    }
+    list.tail = v;
+  }
+
+  void unlink(List& list, int v, Link Voice::*link) {
+    Link& l = m_voices[v].*link;
+    if (l.prev != kNone) {
+      (m_voices[l.prev].*link).next = l.next;
+    } else {
+      list.head = l.next;
+    }
+    if (l.next != kNone) {
+      (m_voices[l.next].*link).prev = l.prev;
+    } else {
+      list.tail = l.prev;
+    }
+    l.prev = l.next = kNone;
+  }
+
+  std::vector<Voice> m_voices;
+  std::vector<int> m_free;
+  List m_playing;
+  List m_released;
+  List m_pitches[kNumPitches];
+};
@@ -0,0 +1,118 @@
+"""Pack single-cycle waveforms into a wavetable bank for the Faust CHOP.
+
+The bank is an FCSB file (see TD-Faust/faustchop_bank.h): every cycle is
+resampled to the same table length and stored with band-limited mip levels,
+already in the DSP's float format, so the Faust CHOP can memory-map it
+instead of decoding WAV files.
+
+Part `cycle * levels + level` holds `cycle` with only the first
+`(table_length / 2) >> level` harmonics, so a table read at frequency `freq`
+doesn't alias at level `ceil(log2(freq * table_length / sample_rate))`.
+
+Example:
+
+    python make_wavetable_bank.py wavetables.fcsb wave_cycle_*.wav additive_synthesis_*.wav
+"""
+
+import argparse
+import glob
+import struct
+
+import numpy as np
+from scipy.io import wavfile
+
+MAX_SOUNDFILE_PARTS = 256
+BUFFER_SIZE = 1024
+ALIGNMENT = 65536
+VERSION = 1
+
+HEADER = struct.Struct('<4s5I2Q')
+PART = struct.Struct('<qii')
+
+
+def read_cycle(path, table_length):
+	"""Read the first channel of a WAV file and resample it, as one period, to table_length."""
+	_, data = wavfile.read(path)
+	if data.ndim > 1:
+		data = data[:, 0]
+	if np.issubdtype(data.dtype, np.integer):
+		data = data / float(np.iinfo(data.dtype).max)
+	spectrum = np.fft.rfft(data.astype(np.float64))
+	bins = table_length // 2 + 1
+	resized = np.zeros(bins, dtype=np.complex128)
+	n = min(bins, len(spectrum))
+	resized[:n] = spectrum[:n]
+	return np.fft.irfft(resized, n=table_length) * (table_length / len(data))
+
+
+def mip_levels(cycle, levels):
+	"""Band-limited copies of a cycle, halving the number of harmonics at each level."""
+	spectrum = np.fft.rfft(cycle)
+	harmonics = len(cycle) // 2
+	tables = []
+	for level in range(levels):
+		limited = spectrum.copy()
+		limited[max(1, harmonics >> level) + 1:] = 0
+		tables.append(np.fft.irfft(limited, n=len(cycle)))
+	return tables
+
+
+def write_bank(path, tables, sample_rate, dtype, key):
+	key = key.encode('utf-8')
+	sample_size = np.dtype(dtype).itemsize
+
+	parts = []
+	frames = 0
+	for table in tables:
+		parts.append(PART.pack(frames, len(table), sample_rate))
+		frames += len(table)
+	frames += BUFFER_SIZE  # silence for the unused parts
+
+	table_size = HEADER.size + PART.size * len(parts) + len(key)
+	data_offset = (table_size + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+	with open(path, 'wb') as f:
+		f.write(HEADER.pack(b'FCSB', VERSION, sample_size, 1, len(parts), len(key), frames, data_offset))
+		f.write(b''.join(parts))
+		f.write(key)
+		f.write(b'\0' * (data_offset - table_size))
+		for table in tables:
+			f.write(np.asarray(table, dtype=dtype).tobytes())
+		f.write(np.zeros(BUFFER_SIZE, dtype=dtype).tobytes())
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument('output', help='the .fcsb file to write')
+	parser.add_argument('inputs', nargs='+', help='single-cycle WAV files (wildcards are allowed)')
+	parser.add_argument('--table-length', type=int, default=2048, help='samples per table, a power of two')
+	parser.add_argument('--levels', type=int, default=0, help='mip levels per cycle (default: down to one harmonic)')
+	parser.add_argument('--sample-rate', type=int, default=44100, help='sample rate stored with each table')
+	parser.add_argument('--double', action='store_true', help='write doubles, for DSPs compiled with -double')
+	args = parser.parse_args()
+
+	if args.table_length < 2 or args.table_length & (args.table_length - 1):
+		parser.error('--table-length must be a power of two')
+
+	inputs = []
+	for pattern in args.inputs:
+		inputs += sorted(glob.glob(pattern)) or [pattern]
+
+	levels = args.levels or int(np.log2(args.table_length // 2)) + 1
+	if len(inputs) * levels > MAX_SOUNDFILE_PARTS:
+		parser.error(f'{len(inputs)} cycles x {levels} levels is more than {MAX_SOUNDFILE_PARTS} parts')
+
+	tables = []
+	for path in inputs:
+		tables += mip_levels(read_cycle(path, args.table_length), levels)
+
+	key = f'wavetable {len(inputs)}x{levels}x{args.table_length}'
+	write_bank(args.output, tables, args.sample_rate, np.float64 if args.double else np.float32, key)
+
+	for i, path in enumerate(inputs):
+		print(f'cycle {i}: {path}')
+	print(f'Wrote {args.output}: {len(inputs)} cycles, {levels} levels, {args.table_length} samples per table.')
+
+
+if __name__ == '__main__':
+	main()
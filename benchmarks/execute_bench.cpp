@@ -0,0 +1,572 @@
+// Cost of FaustCHOP::execute(), cooked through the mock TouchDesigner host
+// (see mock_host) the way google-benchmark runs a benchmark: each one cooks
+// the CHOP for at least --min-time seconds and reports the mean time per
+// cook and per output sample.
+//
+// The DSPs are reverb.dsp from this repository, a bank of 64 sines, a mixer
+// of 64 input channels to stereo and a polyphonic sampler. The suite sweeps
+// the timeslice (1 to 8192 samples), the sample rate of the control input
+// (the second input), the number of notes per second on the MIDI input (the
+// third input) and the number of voices.
+//
+// usage: execute_bench [--plugin path] [--libraries path] [--filter regex]
+//                      [--min-time seconds] [--json path]
+//                      [--baseline path] [--max-regression percent]
+//
+// --plugin is the TD-Faust plugin, by default the one built with this
+// project. --libraries is the Faust libraries directory (share/faust).
+// --json saves the results, and --baseline compares them to results saved
+// before; with --max-regression the run fails if any benchmark got slower
+// by more than that many percent. It also fails if a benchmark couldn't
+// run, for example because its DSP didn't compile.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "td_mock_host.h"
+
+using namespace std::chrono;
+
+namespace {
+
+const int kSampleRate = 48000;
+// Long enough that the inputs don't repeat noticeably
+const int kTapeSamples = 2 * kSampleRate;
+// The notes the MIDI input plays, as MIDI In CHOP channels n48, n49, ...
+const int kFirstNote = 48;
+const int kNumNotes = 24;
+
+struct Options {
+  std::string plugin;
+  std::string libraries;
+  std::string filter;
+  double minTime = 0.5;  // seconds
+  std::string json;
+  std::string baseline;
+  double maxRegression = -1.;  // percent; < 0: don't fail
+};
+
+struct DSP {
+  const char* name;
+  std::string code;
+  int numInputs;
+  bool polyphonic;
+  // parameters set by the control input
+  std::vector<std::string> controls;
+};
+
+struct Case {
+  const DSP* dsp;
+  int timeslice;
+  double controlRate;  // Hz; 0: no control input
+  double midiDensity;  // notes per second
+  int voices;          // 0: not polyphonic
+
+  std::string name() const {
+    std::string name =
+        std::string(dsp->name) + "/timeslice:" + std::to_string(timeslice);
+    if (controlRate > 0.) {
+      name += "/control:" + std::to_string((int)controlRate);
+    }
+    if (dsp->polyphonic) {
+      name += "/midi:" + std::to_string((int)midiDensity) +
+              "/voices:" + std::to_string(voices);
+    }
+    return name;
+  }
+};
+
+struct Result {
+  std::string name;
+  int64_t cooks = 0;
+  int timeslice = 0;
+  double nsPerCook = 0.;
+  double nsPerSample = 0.;
+  std::string error;
+};
+
+std::string readFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+std::vector<DSP> makeDSPs() {
+  std::vector<DSP> dsps;
+
+#ifdef TD_FAUST_REVERB_DSP
+  dsps.push_back(
+      {"reverb", readFile(TD_FAUST_REVERB_DSP), 2, false, {"JPrev/Mix/wet"}});
+#endif
+
+  std::vector<std::string> gains, mixer;
+  for (int i = 0; i < 64; i++) {
+    gains.push_back("gain" + std::to_string(i));
+    mixer.push_back("gain" + std::to_string(i));
+    mixer.push_back("pan" + std::to_string(i));
+  }
+
+  dsps.push_back({"sines", R"(
+import("stdfaust.lib");
+process = par(i, 64, os.osc(55 * (i + 1)) *
+                     hslider("gain%i", 0.01, 0, 1, 0.001)) :> _;
+)",
+                  0, false, gains});
+
+  dsps.push_back({"mixer", R"(
+import("stdfaust.lib");
+gain(i) = hslider("gain%i", 0.5, 0, 1, 0.001) : si.smoo;
+pan(i) = hslider("pan%i", 0.5, 0, 1, 0.001) : si.smoo;
+strip(i) = *(gain(i)) <: *(1 - pan(i)), *(pan(i));
+process = par(i, 64, strip(i)) :> _, _;
+)",
+                  64, false, mixer});
+
+  // Two seconds of noise in a table, played back at the note's pitch
+  dsps.push_back({"sampler", R"(
+import("stdfaust.lib");
+n = 96000;
+freq = hslider("freq", 261.6, 20, 20000, 0.01);
+gain = hslider("gain", 0.5, 0, 1, 0.01);
+gate = button("gate");
+index = os.phasor(n, freq / 261.6 * ma.SR / n) : int;
+process = rdtable(n, no.noise, index) * gain *
+          en.adsr(0.005, 0.1, 0.8, 0.2, gate) <: _, _;
+)",
+                  0, true, {}});
+  return dsps;
+}
+
+std::vector<Case> makeCases(const std::vector<DSP>& dsps) {
+  const int timeslices[] = {1, 16, 64, 256, 1024, 4096, 8192};
+  const double controlRates[] = {60., 1000., (double)kSampleRate};
+  const double midiDensities[] = {0., 10., 100., 1000., 10000.};
+  const int voices[] = {1, 8, 32, 64};
+
+  std::vector<Case> cases;
+  for (const DSP& dsp : dsps) {
+    if (!dsp.polyphonic) {
+      for (int timeslice : timeslices) {
+        cases.push_back({&dsp, timeslice, 0., 0., 0});
+      }
+      for (double rate : controlRates) {
+        cases.push_back({&dsp, 1024, rate, 0., 0});
+      }
+    } else {
+      for (int timeslice : timeslices) {
+        cases.push_back({&dsp, timeslice, 0., 100., 16});
+      }
+      for (double density : midiDensities) {
+        cases.push_back({&dsp, 1024, 0., density, 16});
+      }
+      for (int n : voices) {
+        cases.push_back({&dsp, 1024, 0., 100., n});
+      }
+    }
+  }
+  // The sweeps cross at their defaults.
+  std::vector<Case> unique;
+  std::set<std::string> names;
+  for (const Case& c : cases) {
+    if (names.insert(c.name()).second) {
+      unique.push_back(c);
+    }
+  }
+  return unique;
+}
+
+// A recording the length of whole timeslices, played a timeslice per cook.
+struct Tape {
+  std::vector<std::vector<float>> channels;
+  std::vector<std::string> names;
+  int samplesPerCook = 0;
+  int numCooks = 0;  // before it repeats
+};
+
+Tape noiseTape(int numChannels, int samplesPerCook, int numCooks,
+               std::minstd_rand& random) {
+  std::uniform_real_distribution<float> noise(-1.f, 1.f);
+  Tape tape;
+  tape.samplesPerCook = samplesPerCook;
+  tape.numCooks = numCooks;
+  tape.channels.assign(numChannels,
+                       std::vector<float>(samplesPerCook * numCooks));
+  for (auto& channel : tape.channels) {
+    for (float& sample : channel) {
+      sample = noise(random);
+    }
+  }
+  return tape;
+}
+
+// Random note ons and offs, about `density` per second, starting and ending
+// with every note off so that the tape loops cleanly.
+Tape midiTape(double density, int timeslice, int numCooks,
+              std::minstd_rand& random) {
+  Tape tape;
+  tape.samplesPerCook = timeslice;
+  tape.numCooks = numCooks;
+  const int length = timeslice * numCooks;
+  tape.channels.assign(kNumNotes, std::vector<float>(length, 0.f));
+  for (int n = 0; n < kNumNotes; n++) {
+    tape.names.push_back("n" + std::to_string(kFirstNote + n));
+  }
+
+  const int numEvents = (int)(density * length / kSampleRate);
+  std::vector<int> times(numEvents);
+  std::uniform_int_distribution<int> time(1, std::max(length - 2, 1));
+  for (int& t : times) {
+    t = time(random);
+  }
+  std::sort(times.begin(), times.end());
+
+  // Each event toggles a note, which holds its value until the next event
+  // on it (or the last sample).
+  std::uniform_int_distribution<int> note(0, kNumNotes - 1);
+  std::uniform_real_distribution<float> velocity(0.3f, 1.f);
+  std::vector<int> since(kNumNotes, 0);
+  std::vector<float> value(kNumNotes, 0.f);
+  for (int t : times) {
+    const int n = note(random);
+    std::vector<float>& channel = tape.channels[n];
+    std::fill(channel.begin() + since[n], channel.begin() + t, value[n]);
+    since[n] = t;
+    value[n] = value[n] > 0.f ? 0.f : velocity(random);
+  }
+  for (int n = 0; n < kNumNotes; n++) {
+    std::fill(tape.channels[n].begin() + since[n], tape.channels[n].end() - 1,
+              value[n]);
+  }
+  return tape;
+}
+
+std::string formatTime(double ns) {
+  char text[32];
+  if (ns < 1e3) {
+    snprintf(text, sizeof(text), "%.1f ns", ns);
+  } else if (ns < 1e6) {
+    snprintf(text, sizeof(text), "%.2f us", ns / 1e3);
+  } else {
+    snprintf(text, sizeof(text), "%.2f ms", ns / 1e6);
+  }
+  return text;
+}
+
+std::string jsonEscape(const std::string& text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else if ((unsigned char)c >= 0x20) {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// The results saved by writeJson(), by name.
+std::map<std::string, double> readBaseline(const std::string& path) {
+  std::map<std::string, double> baseline;
+  std::ifstream file(path);
+  std::string line;
+  // One benchmark per line, see writeJson()
+  const std::regex entry(
+      R"re("name": "([^"]*)".*"ns_per_cook": ([-+0-9.eE]+))re");
+  std::smatch match;
+  while (std::getline(file, line)) {
+    if (std::regex_search(line, match, entry)) {
+      baseline[match[1]] = atof(match[2].str().c_str());
+    }
+  }
+  return baseline;
+}
+
+void writeJson(FILE* out, const Options& options,
+               const std::vector<Result>& results) {
+  fprintf(out, "{\n  \"plugin\": \"%s\",\n",
+          jsonEscape(options.plugin).c_str());
+  fprintf(out, "  \"sample_rate\": %d,\n  \"min_time\": %g,\n", kSampleRate,
+          options.minTime);
+  fprintf(out, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"timeslice\": %d, \"cooks\": %lld, "
+            "\"ns_per_cook\": %.1f, \"ns_per_sample\": %.3f, "
+            "\"error\": \"%s\"}%s\n",
+            r.name.c_str(), r.timeslice, (long long)r.cooks, r.nsPerCook,
+            r.nsPerSample, jsonEscape(r.error).c_str(),
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+class Suite {
+ public:
+  Suite(const Options& options, const TDMock::Plugin& plugin)
+      : m_options(options), m_plugin(plugin) {}
+
+  Result run(const Case& c) {
+    Result result;
+    result.name = c.name();
+    result.timeslice = c.timeslice;
+
+    TDMock::CHOP* chop = get(*c.dsp, c.voices, result.error);
+    if (!chop) {
+      return result;
+    }
+
+    // Enough cooks for a couple of seconds of input before it repeats
+    const int numCooks = std::max(1, kTapeSamples / c.timeslice);
+    std::minstd_rand random(1);
+    std::vector<std::pair<int, Tape>> tapes;
+    if (c.dsp->numInputs) {
+      tapes.emplace_back(
+          0, noiseTape(c.dsp->numInputs, c.timeslice, numCooks, random));
+    }
+    if (c.controlRate > 0.) {
+      // The control input's own sample rate sets its length.
+      const int samples = std::max(
+          1, (int)std::lround(c.timeslice * c.controlRate / kSampleRate));
+      Tape tape = noiseTape((int)c.dsp->controls.size(), samples, numCooks,
+                            random);
+      for (auto& channel : tape.channels) {
+        for (float& value : channel) {
+          value = 0.5f + 0.5f * value;
+        }
+      }
+      tape.names = c.dsp->controls;
+      tapes.emplace_back(1, std::move(tape));
+    }
+    if (c.dsp->polyphonic) {
+      tapes.emplace_back(2,
+                         midiTape(c.midiDensity, c.timeslice, numCooks, random));
+    }
+
+    for (int index = 0; index < 3; index++) {
+      chop->disconnect(index);
+    }
+    for (auto& it : tapes) {
+      const double rate = it.first == 1 ? c.controlRate : kSampleRate;
+      chop->input(it.first).set(std::move(it.second.channels),
+                                std::move(it.second.names), rate);
+    }
+    chop->pulse("Clearmidi");
+
+    int64_t cook = 0;
+    auto cookOnce = [&]() {
+      for (auto& it : tapes) {
+        const Tape& tape = it.second;
+        chop->input(it.first).setWindow(
+            (int)(cook % tape.numCooks) * tape.samplesPerCook,
+            tape.samplesPerCook);
+      }
+      cook++;
+      chop->cook(c.timeslice);
+    };
+
+    // Warm up the caches, the allocations and the voices.
+    const auto warmupEnd =
+        steady_clock::now() + duration<double>(m_options.minTime / 10.);
+    do {
+      cookOnce();
+    } while (steady_clock::now() < warmupEnd);
+    if (!chop->error().empty()) {
+      result.error = chop->error();
+      return result;
+    }
+
+    cook = 0;
+    const auto start = steady_clock::now();
+    const auto end = start + duration<double>(m_options.minTime);
+    auto now = start;
+    do {
+      cookOnce();
+      now = steady_clock::now();
+    } while (now < end);
+
+    result.cooks = cook;
+    result.nsPerCook =
+        duration<double, std::nano>(now - start).count() / (double)cook;
+    result.nsPerSample = result.nsPerCook / c.timeslice;
+    return result;
+  }
+
+ private:
+  // A compiled CHOP for this DSP and number of voices, kept for the cases
+  // that follow since compiling takes a while.
+  TDMock::CHOP* get(const DSP& dsp, int voices, std::string& error) {
+    const std::string key = std::string(dsp.name) + "/" +
+                            std::to_string(voices);
+    auto it = m_chops.find(key);
+    if (it != m_chops.end()) {
+      return it->second.get();
+    }
+
+    std::unique_ptr<TDMock::CHOP> chop(new TDMock::CHOP(m_plugin));
+    if (!chop->setParDAT("Code", dsp.code)) {
+      error = "The plugin has no Code parameter; is it TD-Faust?";
+      return nullptr;
+    }
+    chop->setPar("Samplerate", kSampleRate);
+    if (!m_options.libraries.empty()) {
+      chop->setParString("Faustlibrariespath", m_options.libraries);
+    }
+    chop->setPar("Polyphony", dsp.polyphonic ? 1. : 0.);
+    chop->setPar("Nvoices", voices);
+    chop->pulse("Compile");
+    // The code is compiled in the next cook.
+    chop->cook(1);
+    if (!chop->error().empty()) {
+      error = chop->error();
+      return nullptr;
+    }
+    TDMock::CHOP* result = chop.get();
+    m_chops[key] = std::move(chop);
+    return result;
+  }
+
+  const Options& m_options;
+  const TDMock::Plugin& m_plugin;
+  std::map<std::string, std::unique_ptr<TDMock::CHOP>> m_chops;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+#ifdef TD_FAUST_PLUGIN
+  options.plugin = TD_FAUST_PLUGIN;
+#endif
+#ifdef TD_FAUST_LIBRARIES_DIR
+  options.libraries = TD_FAUST_LIBRARIES_DIR;
+#endif
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--plugin" && hasValue) {
+      options.plugin = argv[++i];
+    } else if (arg == "--libraries" && hasValue) {
+      options.libraries = argv[++i];
+    } else if (arg == "--filter" && hasValue) {
+      options.filter = argv[++i];
+    } else if (arg == "--min-time" && hasValue) {
+      options.minTime = atof(argv[++i]);
+    } else if (arg == "--json" && hasValue) {
+      options.json = argv[++i];
+    } else if (arg == "--baseline" && hasValue) {
+      options.baseline = argv[++i];
+    } else if (arg == "--max-regression" && hasValue) {
+      options.maxRegression = atof(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--plugin path] [--libraries path] [--filter regex] "
+              "[--min-time seconds] [--json path] [--baseline path] "
+              "[--max-regression percent]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (options.plugin.empty()) {
+    fprintf(stderr, "Give the path of the TD-Faust plugin with --plugin.\n");
+    return 1;
+  }
+
+  TDMock::Plugin plugin;
+  std::string error;
+  if (!plugin.load(options.plugin, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  std::map<std::string, double> baseline;
+  if (!options.baseline.empty()) {
+    baseline = readBaseline(options.baseline);
+    if (baseline.empty()) {
+      fprintf(stderr, "No results in %s\n", options.baseline.c_str());
+      return 1;
+    }
+  }
+
+  const std::vector<DSP> dsps = makeDSPs();
+  const std::regex filter(options.filter.empty() ? ".*" : options.filter);
+  Suite suite(options, plugin);
+  std::vector<Result> results;
+  std::vector<std::string> regressions;
+  std::vector<std::string> failures;
+
+  printf("%-48s %12s %12s %10s%s\n", "Benchmark", "Time/cook", "Time/sample",
+         "Cooks", baseline.empty() ? "" : "   Baseline");
+  printf("%s\n", std::string(baseline.empty() ? 85 : 96, '-').c_str());
+  for (const Case& c : makeCases(dsps)) {
+    const std::string name = c.name();
+    if (!std::regex_search(name, filter)) {
+      continue;
+    }
+    Result result = suite.run(c);
+    if (!result.error.empty()) {
+      printf("%-48s ERROR: %s\n", name.c_str(), result.error.c_str());
+      failures.push_back(name);
+    } else {
+      printf("%-48s %12s %12s %10lld", name.c_str(),
+             formatTime(result.nsPerCook).c_str(),
+             formatTime(result.nsPerSample).c_str(),
+             (long long)result.cooks);
+      auto it = baseline.find(name);
+      if (it != baseline.end() && it->second > 0.) {
+        const double change = 100. * (result.nsPerCook / it->second - 1.);
+        printf("   %+7.1f%%", change);
+        if (options.maxRegression >= 0. && change > options.maxRegression) {
+          regressions.push_back(name);
+        }
+      }
+      printf("\n");
+    }
+    fflush(stdout);
+    results.push_back(result);
+  }
+
+  if (!options.json.empty()) {
+    FILE* out = fopen(options.json.c_str(), "w");
+    if (!out) {
+      fprintf(stderr, "Could not open %s\n", options.json.c_str());
+      return 1;
+    }
+    writeJson(out, options, results);
+    fclose(out);
+  }
+
+  if (!regressions.empty()) {
+    printf("\n%d benchmarks are more than %g%% slower than the baseline:\n",
+           (int)regressions.size(), options.maxRegression);
+    for (const std::string& name : regressions) {
+      printf("  %s\n", name.c_str());
+    }
+  }
+  // A benchmark that didn't run can't have passed.
+  if (!failures.empty()) {
+    printf("\n%d benchmarks failed:\n", (int)failures.size());
+    for (const std::string& name : failures) {
+      printf("  %s\n", name.c_str());
+    }
+    return 1;
+  }
+  return regressions.empty() ? 0 : 2;
+}
@@ -7,6 +7,8 @@ from os.path import isfile, isdir, abspath
 import subprocess
 import shlex
 import platform
+import shutil
+import glob
 
 
 def parse_ui(items, labels=[]) -> None:
@@ -23,7 +25,7 @@ def parse_ui(items, labels=[]) -> None:
             parse_ui(item['items'], labels=labels)
 
 
-def item_to_td_parname(item) -> str:
+def item_to_td_parname(item, prefix='') -> str:
     address = item['address']
     if address.startswith('/'):
         address = address[1:]
@@ -31,7 +33,7 @@ def item_to_td_parname(item) -> str:
     address = address.split('/')
     if len(address) > 1 and drop_prefix:
         address = address[1:]
-    address = '/'.join(address)
+    address = prefix + '/'.join(address)
 
     address = re.sub('[^a-zA-Z0-9]', '', address)
 
@@ -40,8 +42,15 @@ def item_to_td_parname(item) -> str:
     return address
 
 
-def add_par_double(item) -> str:
-    parname = item_to_td_parname(item)
+def page_line(var, page) -> str:
+    if page is None:
+        return ''
+    page = page.replace('"', '\\"')
+    return f'\n    {var}.page = "{page}";'
+
+
+def add_par_double(item, prefix='', page=None) -> str:
+    parname = item_to_td_parname(item, prefix)
     label = item['label'].replace('"', '\\"')
     init = item['init']
     min_val = item['min']
@@ -51,7 +60,7 @@ def add_par_double(item) -> str:
     OP_NumericParameter np;
 
     np.name = "{parname}";
-    np.label = "{label}";
+    np.label = "{label}";{page_line('np', page)}
     np.defaultValues[0] = {init};
     np.minSliders[0] = np.minValues[0] = {min_val};
     np.maxSliders[0] = np.maxValues[0] = {max_val};
@@ -69,8 +78,8 @@ def legalName(text) -> str:
     return text
 
 
-def add_nentry(item) -> str:
-    parname = item_to_td_parname(item)
+def add_nentry(item, prefix='', page=None) -> str:
+    parname = item_to_td_parname(item, prefix)
     label = item['label'].replace('"', '\\"')
     init = item['init']
     theMin = item['min']
@@ -110,7 +119,7 @@ def add_nentry(item) -> str:
     OP_StringParameter	sp;
 
     sp.name = "{parname}";
-    sp.label = "{label}";
+    sp.label = "{label}";{page_line('sp', page)}
 
     sp.defaultValue = "{init}";
 
@@ -123,9 +132,9 @@ def add_nentry(item) -> str:
     return text
 
 
-def add_toggle(item) -> str:
+def add_toggle(item, prefix='', page=None) -> str:
 
-    parname = item_to_td_parname(item)
+    parname = item_to_td_parname(item, prefix)
     label = item['label'].replace('"', '\\"')
 
     text = f"""
@@ -133,7 +142,7 @@ def add_toggle(item) -> str:
     OP_NumericParameter np;
 
     np.name = "{parname}";
-    np.label = "{label}";
+    np.label = "{label}";{page_line('np', page)}
 
     OP_ParAppendResult res = manager->appendToggle(np);
     assert(res == OP_ParAppendResult::Success);
@@ -141,6 +150,257 @@ def add_toggle(item) -> str:
     return text
 
 
+def run_faust(dsp_file, output, libfaust_dir, options=[], json=False) -> bool:
+    """Turn the Faust code into a C++ FaustDSP class, using the faust2touchdesigner architecture file."""
+    faust_args = ['-i', dsp_file, '-lang', 'cpp', '-cn', 'FaustDSP'] + (['-json'] if json else []) + options + \
+        ['-a', 'faust2touchdesigner/template_faustaudio.h', '-o', output]
+
+    # Maybe `faust` isn't in PATH, so fall back to the libfaust binary.
+    for faust in ['faust', f'{libfaust_dir}/bin/faust']:
+        try:
+            print(f'Executing faust script:\n{shlex.join([faust] + faust_args)}')
+            return subprocess.call([faust] + faust_args) == 0
+        except FileNotFoundError as e:
+            error = e
+    raise error
+
+
+# Faust options searched by --optimize: every code generation mode is combined
+# with every max copy delay and every flush-to-zero mode. The first combination
+# is Faust's default.
+OPTIMIZE_MODES = [[]] + [['-vec', '-vs', vs] + loops for vs in ['16', '32', '64']
+                         for loops in [['-lv', '0'], ['-lv', '1'], ['-lv', '0', '-fun'], ['-lv', '0', '-dfs']]]
+OPTIMIZE_MCD = [['-mcd', '16'], ['-mcd', '64']]
+OPTIMIZE_FTZ = [['-ftz', '0'], ['-ftz', '2']]
+
+# The block size of the template's execute() and its default sample rate.
+TEMPLATE_BLOCK_SIZE = 1024
+TEMPLATE_SAMPLE_RATE = 44100
+
+
+def optimize(dsp_file, op_type, libfaust_dir, cmake_build_arch, sample_rate=TEMPLATE_SAMPLE_RATE,
+             block_size=TEMPLATE_BLOCK_SIZE) -> list:
+    """Time the DSP generated with every combination of Faust options above, write a report, and return the fastest options."""
+    work_dir = abspath(f'build_{op_type}_optimize')
+
+    variants = []
+    for mode in OPTIMIZE_MODES:
+        for mcd in OPTIMIZE_MCD:
+            for ftz in OPTIMIZE_FTZ:
+                variant_dir = os.path.join(work_dir, f'variant_{len(variants)}')
+                os.makedirs(variant_dir, exist_ok=True)
+                options = mode + mcd + ftz
+                generated = run_faust(dsp_file, os.path.join(variant_dir, 'FaustDSP.h'), libfaust_dir, options)
+                variants.append({'options': options, 'dir': variant_dir, 'status': 'ok' if generated else 'faust failed'})
+
+    # Build one timing executable per generated variant (see faust2touchdesigner/timing).
+    built = [v for v in variants if v['status'] == 'ok']
+    variant_dirs = ';'.join(v['dir'].replace('\\', '/') for v in built)
+    build_dir = os.path.join(work_dir, 'build')
+    subprocess.call(['cmake', '-S', 'faust2touchdesigner/timing', '-B', build_dir, f'-DFAUST_VARIANT_DIRS={variant_dirs}',
+                     f'-DLIBFAUST_DIR={libfaust_dir}', '-DCMAKE_BUILD_TYPE=Release', cmake_build_arch])
+    subprocess.call(['cmake', '--build', build_dir, '--config', 'Release', '--parallel'])
+
+    exe_suffix = '.exe' if platform.system() == 'Windows' else ''
+    for i, variant in enumerate(built):
+        exe = os.path.join(variant['dir'], f'timing_{i}{exe_suffix}')
+        if not isfile(exe):
+            # A failed variant may have stopped the parallel build early.
+            subprocess.call(['cmake', '--build', build_dir, '--config', 'Release', '--target', f'timing_{i}'])
+        if not isfile(exe):
+            variant['status'] = 'build failed'
+            continue
+        print(f'Timing {shlex.join(variant["options"])}')
+        try:
+            result = subprocess.run([exe, str(sample_rate), str(block_size)],
+                                    capture_output=True, text=True, timeout=300, check=True)
+            ns_per_sample, rms = result.stdout.split()
+            variant['ns_per_sample'] = float(ns_per_sample)
+            variant['rms'] = float(rms)
+        except (subprocess.SubprocessError, ValueError):
+            variant['status'] = 'run failed'
+
+    # Don't pick a variant whose output differs from the default one's.
+    timed = [v for v in variants if 'ns_per_sample' in v]
+    reference = variants[0].get('rms')
+    for variant in timed:
+        if reference is not None and not math.isclose(variant['rms'], reference, rel_tol=1e-2, abs_tol=1e-6):
+            variant['status'] = 'output differs'
+    candidates = [v for v in timed if v['status'] == 'ok']
+    if not candidates:
+        raise RuntimeError(f'None of the optimization variants could be timed, see {work_dir}.')
+    fastest = min(candidates, key=lambda v: v['ns_per_sample'])
+
+    report_file = os.path.join(work_dir, 'optimize_report.json')
+    with open(report_file, 'w') as f:
+        json.dump({
+            'dsp': dsp_file,
+            'sample_rate': sample_rate,
+            'block_size': block_size,
+            'fastest': fastest['options'],
+            'variants': [{key: v[key] for key in ['options', 'status', 'ns_per_sample', 'rms'] if key in v}
+                         for v in variants],
+        }, f, indent=2)
+
+    print(f'\n{"ns/sample":>10}  {"status":<14}  options')
+    for variant in sorted(variants, key=lambda v: v.get('ns_per_sample', math.inf)):
+        ns = f'{variant["ns_per_sample"]:.3f}' if 'ns_per_sample' in variant else '-'
+        print(f'{ns:>10}  {variant["status"]:<14}  {shlex.join(variant["options"])}')
+    default_ns = variants[0].get('ns_per_sample')
+    speedup = f' ({default_ns / fastest["ns_per_sample"]:.2f}x the default options)' if default_ns else ''
+    print(f'\nFastest: {shlex.join(fastest["options"])}{speedup}')
+    print(f'Wrote {report_file}\n')
+
+    return fastest['options']
+
+
+def specialize_sample_rate(code, sample_rate, work_dir, libfaust_dir, cmake_build_arch):
+    """Turn the constants a generated FaustDSP computes in instanceConstants() into compile-time constants for one
+    sample rate. Their values come from running instanceConstants() itself (see faust2touchdesigner/specialize), so
+    they are exactly what the DSP would compute. Returns the new code, or None if the code isn't as expected."""
+    match = re.search(r'^([ \t]*(?:virtual )?void instanceConstants\(int sample_rate\) \{\n)(.*?)(^[ \t]*\}$)', code,
+                      re.MULTILINE | re.DOTALL)
+    if not match:
+        return None
+    constants = []
+    for line in match.group(2).splitlines():
+        line = line.strip()
+        if line == 'fSampleRate = sample_rate;' or not line:
+            continue
+        assignment = re.match(r'^([fi]Const\d+) = .*;$', line)
+        if not assignment:
+            return None
+        constants.append(assignment.group(1))
+    declarations = {}
+    for name in constants + ['fSampleRate']:
+        declaration = re.search(rf'^([ \t]*)(int|float|double) {name};$', code, re.MULTILINE)
+        if not declaration:
+            return None
+        declarations[name] = declaration
+
+    values = {}
+    if constants:
+        os.makedirs(work_dir, exist_ok=True)
+        with open(os.path.join(work_dir, 'FaustDSP.h'), 'w') as f:
+            f.write(re.sub(r'^([ \t]*)private:', r'\1public:', code, flags=re.MULTILINE))
+        with open(os.path.join(work_dir, 'FaustDSPConstants.h'), 'w') as f:
+            f.write(''.join(f'FAUST_CONSTANT({name})\n' for name in constants))
+        build_dir = os.path.join(work_dir, 'build')
+        subprocess.call(['cmake', '-S', 'faust2touchdesigner/specialize', '-B', build_dir, f'-DFAUST_DSP_DIR={work_dir}',
+                         f'-DLIBFAUST_DIR={libfaust_dir}', '-DCMAKE_BUILD_TYPE=Release', cmake_build_arch])
+        subprocess.call(['cmake', '--build', build_dir, '--config', 'Release'])
+        exe = os.path.join(work_dir, 'constants' + ('.exe' if platform.system() == 'Windows' else ''))
+        try:
+            result = subprocess.run([exe, str(sample_rate)], capture_output=True, text=True, timeout=60, check=True)
+            for line in result.stdout.splitlines():
+                name, value = line.split()
+                values[name] = float.fromhex(value)
+        except (OSError, subprocess.SubprocessError, ValueError):
+            return None
+        if set(values) != set(constants) or not all(math.isfinite(v) for v in values.values()):
+            return None
+
+    def declare(name, value_type, value):
+        if value_type == 'int':
+            literal = str(int(value))
+        else:
+            literal = float(value).hex() + ('f' if value_type == 'float' else '')
+        return f'static constexpr {value_type} {name} = {literal};'
+
+    # Replace the last match first so that the earlier offsets stay valid.
+    body_indent = re.match(r'[ \t]*', match.group(2)).group(0)
+    edits = [(match.start(2), match.end(2), f'{body_indent}// Fixed at compile time by faust2td.py --sample-rate.\n')]
+    for name, declaration in declarations.items():
+        value = sample_rate if name == 'fSampleRate' else values[name]
+        edits.append((declaration.start(2), declaration.end(), declare(name, declaration.group(2), value)))
+    for start, end, text in sorted(edits, reverse=True):
+        code = code[:start] + text + code[end:]
+    return code
+
+
+def specialize_block_size(code, block_size):
+    """Give the generated compute() a copy for blocks of `block_size` samples, where the loops have a constant trip
+    count. Other block sizes still work. Returns the new code, or None if the code isn't as expected."""
+    match = re.search(r'^([ \t]*)(?:virtual )?void compute\(int count, ([^)]*\b(\w+), [^)]*\b(\w+))\) \{$', code,
+                      re.MULTILINE)
+    if not match:
+        return None
+    indent, params, inputs, outputs = match.groups()
+    wrapper = f"""{indent}virtual void compute(int count, {params}) {{
+{indent}\t// Specialized by faust2td.py --block-size.
+{indent}\tif (count == {block_size}) {{
+{indent}\t\tcomputeBlock({block_size}, {inputs}, {outputs});
+{indent}\t}} else {{
+{indent}\t\tcomputeBlock(count, {inputs}, {outputs});
+{indent}\t}}
+{indent}}}
+
+{indent}FAUSTCHOP_ALWAYS_INLINE void computeBlock(int count, {params}) {{"""
+    return code[:match.start()] + wrapper + code[match.end():]
+
+
+def run_bench(build_dir, op_type, bench_args, json_file) -> dict:
+    """Build the plugin's bench (see faust2touchdesigner/faustchop_bench.cpp), run it, and return its JSON report."""
+    subprocess.call(['cmake', '--build', build_dir, '--config', 'Release', '--target', f'{op_type}_bench'])
+    exe = f'{op_type}_bench' + ('.exe' if platform.system() == 'Windows' else '')
+    # Multi-config generators (Xcode, Visual Studio) build into a folder per config.
+    for path in [os.path.join(build_dir, 'Release', exe), os.path.join(build_dir, exe)]:
+        if isfile(path):
+            subprocess.run([path] + bench_args + ['--json', json_file], check=True)
+            with open(json_file, 'r') as f:
+                return json.load(f)
+    raise RuntimeError(f'The bench {exe} was not built in {build_dir}.')
+
+
+def pgo_train(cmake_configure, build_dir, op_type, num_dsps, bench_args, pgo_dir) -> list:
+    """Time the DSPs built as usual, then build them instrumented and run them to collect a profile in pgo_dir for
+    FAUST_PGO=USE (see faust2touchdesigner/CMakeLists.txt). Returns the bench reports of the usual build."""
+    shutil.rmtree(pgo_dir, ignore_errors=True)
+    os.makedirs(pgo_dir)
+
+    subprocess.call(cmake_configure + ['-DFAUST_PGO=OFF'])
+    before = [run_bench(build_dir, op_type, bench_args + ['--dsp', str(i)], os.path.join(pgo_dir, f'before_{i}.json'))
+              for i in range(num_dsps)]
+
+    print('Collecting a profile of the DSPs')
+    subprocess.call(cmake_configure + ['-DFAUST_PGO=GENERATE', f'-DFAUST_PGO_DIR={pgo_dir}'])
+    for i in range(num_dsps):
+        run_bench(build_dir, op_type, bench_args + ['--dsp', str(i)], os.path.join(pgo_dir, f'training_{i}.json'))
+
+    # Clang writes a raw profile per binary, which has to be merged. GCC's can be used as they are.
+    raw_profiles = glob.glob(os.path.join(pgo_dir, '*.profraw'))
+    if raw_profiles:
+        llvm_profdata = ['xcrun', 'llvm-profdata'] if platform.system() == 'Darwin' else ['llvm-profdata']
+        subprocess.run(llvm_profdata + ['merge', f'-output={os.path.join(pgo_dir, "default.profdata")}'] + raw_profiles,
+                       check=True)
+    return before
+
+
+def pgo_report(before, after, dsp_names, pgo_dir) -> None:
+    """Print and write the speedup of the profile-guided build."""
+    rows = []
+    for dsp_name, dsp_before, dsp_after in zip(dsp_names, before, after):
+        for result_before, result_after in zip(dsp_before['results'], dsp_after['results']):
+            rows.append({
+                'dsp': dsp_name,
+                'sample_rate': result_before['sample_rate'],
+                'block_size': result_before['block_size'],
+                'ns_per_sample_before': result_before['ns_per_sample'],
+                'ns_per_sample_after': result_after['ns_per_sample'],
+                'speedup': result_before['ns_per_sample'] / result_after['ns_per_sample'],
+            })
+
+    report_file = os.path.join(pgo_dir, 'pgo_report.json')
+    with open(report_file, 'w') as f:
+        json.dump({'isa': after[0]['isa'], 'results': rows}, f, indent=2)
+
+    print(f'\n{"dsp":<16} {"rate":>6} {"block":>6} {"before":>10} {"after":>10} {"speedup":>8}')
+    for row in rows:
+        print(f'{row["dsp"]:<16} {row["sample_rate"]:>6} {row["block_size"]:>6} {row["ns_per_sample_before"]:>10.3f} '
+              f'{row["ns_per_sample_after"]:>10.3f} {row["speedup"]:>7.2f}x')
+    print(f'(ns/sample) Wrote {report_file}\n')
+
+
 def get_libfaust_dir():
     cmake_build_arch = f"-DCMAKE_OSX_ARCHITECTURES=x86_64"
 
@@ -172,7 +432,9 @@ def get_libfaust_dir():
 if __name__ == '__main__':
 
     parser = argparse.ArgumentParser()
-    parser.add_argument('--dsp', required=True, help="The path (relative or absolute) to a text file containing Faust DSP code.")
+    parser.add_argument('--dsp', required=True, nargs='+', help="The path (relative or absolute) to a text file containing "
+                        "Faust DSP code. With several paths, all the DSPs are built into one plugin and selected with "
+                        "the CHOP's DSP menu.")
     parser.add_argument('--type', required=True, help='The unique name for this CHOP. It must start with a '
                         'capital A-Z character, and all the following characters must lower case or numbers (a-z, 0-9)')
     parser.add_argument('--label', required=True, help='The text that will show up in the OP Create Dialog.')
@@ -183,6 +445,29 @@ if __name__ == '__main__':
     parser.add_argument('--drop-prefix', required=False, action='store_true', default=False,
                         help="Automatically drop the first group name to make the CHOP's parameter names shorter.")
     parser.add_argument("--arch", default=platform.machine(), help="CPU Architecture for which to build.")
+    parser.add_argument('--polyphonic', required=False, action='store_true', default=False,
+                        help="Play the DSP with MIDI-controlled voices. The CHOP gets N Voices, Group Voices and "
+                        "Dynamic Voices parameters and takes a MIDI CHOP as its second input. The default number of "
+                        "voices comes from the DSP's [nvoices:N] option.")
+    parser.add_argument('--optimize', required=False, action='store_true', default=False,
+                        help="Time the DSP generated with many combinations of Faust options (-vec, -vs, -lv, -fun, "
+                        "-dfs, -mcd, -ftz) and build the plugin with the fastest. The report is written to "
+                        "build_<type>_optimize/optimize_report.json.")
+    parser.add_argument('--sample-rate', required=False, type=int, default=0,
+                        help="Build the DSP for this sample rate only. Its sample-rate-dependent constants are computed "
+                        "once and compiled in, and the CHOP reports an error at any other rate.")
+    parser.add_argument('--block-size', required=False, type=int, default=0,
+                        help="Compile the DSP for blocks of this many samples, and have the CHOP compute in blocks of "
+                        "this size. Shorter blocks still work, but are slower.")
+    parser.add_argument('--pgo', required=False, action='store_true', default=False,
+                        help="Profile-guided optimization: run an instrumented build of the DSP on --pgo-trace and "
+                        "--pgo-input, rebuild it with the profile, and report the speedup. Not available with MSVC.")
+    parser.add_argument('--pgo-trace', required=False, default=None,
+                        help="Parameter changes to play during --pgo: a text file with a '<seconds> <address> <value>' "
+                        "line per change. Without it, the parameters are randomized.")
+    parser.add_argument('--pgo-input', required=False, default=None,
+                        help="Audio input during --pgo: raw 32-bit floats with the DSP's channels interleaved. Without "
+                        "it, the input is white noise.")
 
     args = parser.parse_args()
 
@@ -200,95 +485,159 @@ if __name__ == '__main__':
 
     assert len(op_icon) == 3, "The OP icon must be three letters or numbers."
 
-    dsp_file = args.dsp
-    assert isfile(dsp_file), f'The requested DSP file "{dsp_file}" was not found.'
-
-    libfaust_dir, cmake_build_arch = get_libfaust_dir()
-
-    # Turn the Faust code into C++ code:
-    faust_script = f'faust -i "{dsp_file}" -lang cpp -cn FaustDSP -json -a faust2touchdesigner/template_faustaudio.h -o faust2touchdesigner/{op_type}.h'
-    
-    try:
-        print(f'Executing faust script:\n{faust_script}')
-        subprocess.call(shlex.split(faust_script))
-    except FileNotFoundError as e:
-        # Maybe `faust` isn't in PATH, so default to trying the libfaust binary.
-        faust_script = f'{libfaust_dir}/bin/' + faust_script
-        print(f'Executing faust script:\n{faust_script}')
-        subprocess.call(shlex.split(faust_script))
-
-    assert isfile(f'faust2touchdesigner/{op_type}.h')
+    dsp_files = args.dsp
+    for dsp_file in dsp_files:
+        assert isfile(dsp_file), f'The requested DSP file "{dsp_file}" was not found.'
 
-    json_file = dsp_file + '.json'
-    assert isfile(json_file), f"The JSON file wasn't found at {json_file}"
+    # With several DSPs, they all go in one plugin and a menu selects one. Their
+    # parameters are on a page each, and prefixed with the DSP's name.
+    bundle = len(dsp_files) > 1
 
-    with open(json_file, 'r') as f:
-        text = f.readlines()
+    assert args.sample_rate >= 0 and args.block_size >= 0, "The sample rate and block size can't be negative."
+    for pgo_file in [args.pgo_trace, args.pgo_input]:
+        assert pgo_file is None or isfile(pgo_file), f'The requested PGO file "{pgo_file}" was not found.'
 
-        # hacky thing to fix invalid json
-        text = '\n'.join([line for line in text if '"library_list":' not in line and '"include_pathnames":' not in line])
-
-        j = json.loads(text)
+    libfaust_dir, cmake_build_arch = get_libfaust_dir()
 
     # input widget types are ones which will need custom parameters on a Base COMP.
     INPUT_WIDGET_TYPES = ['button', 'checkbox', 'nentry', 'hslider', 'vslider']
     OUTPUT_WIDGET_TYPES = ['hbargraph', 'vbargraph']
     GROUP_WIDGET_TYPES = ['hgroup', 'vgroup', 'tgroup']
 
-    ui_leaf_items = []
-
-    parse_ui(j['ui'])
-
-    # remove duplicate addresses
-    addresses = set()
-    ui_leaf_items_copy = []
-    for item in ui_leaf_items:
-        if item['address'] not in addresses:
-            addresses.add(item['address'])
-            ui_leaf_items_copy.append(item)
-
-    ui_leaf_items = ui_leaf_items_copy
-    del ui_leaf_items_copy
-
-    set_par_values = []
-
-    for item in ui_leaf_items:
-        address = item['address']
-        parname = item_to_td_parname(item)
-        widgettype = item['type']
-        if widgettype in ['hslider', 'vslider']:
-            set_par_values.append(f'm_ui.setParamValue("{address}", inputs->getParDouble("{parname}"));')
-        elif widgettype in ['checkbox', 'button']:
-            set_par_values.append(f'm_ui.setParamValue("{address}", inputs->getParInt("{parname}"));')
-        elif widgettype == 'nentry':
-            set_par_values.append(f'm_ui.setParamValue("{address}", inputs->getParInt("{parname}"));')
-        elif widgettype in OUTPUT_WIDGET_TYPES:
-            pass
-        else:
-            raise ValueError(f"Unknown widget type: {widgettype}")
-
-    set_par_values = '\n'.join(set_par_values)
+    # With polyphony these are set by each voice's MIDI notes rather than by
+    # CHOP parameters.
+    MIDI_VOICE_PARAMETERS = ['freq', 'gain', 'gate', 'note']
 
+    nvoices = None
+    dsp_names = []
+    dsp_labels = []
+    dsp_headers = []
+    parameters = []
     setup_parameters = []
 
-    for item in ui_leaf_items:
-        widgettype = item['type']
-        if widgettype in ['hslider', 'vslider']:
-            setup_parameters.append(add_par_double(item))
-        elif widgettype == 'button':
-            setup_parameters.append(add_toggle(item))
-        elif widgettype == 'checkbox':
-            setup_parameters.append(add_toggle(item))
-        elif widgettype == 'nentry':
-            setup_parameters.append(add_nentry(item))
-        elif widgettype in OUTPUT_WIDGET_TYPES:
-            # todo: automatically build a UI for the user?
-            pass
-        else:
-            raise ValueError(f"Unkown ui widget type: {widgettype}")
-
+    for index, dsp_file in enumerate(dsp_files):
+        dsp_label = os.path.splitext(os.path.basename(dsp_file))[0]
+        dsp_name = re.sub('[^a-zA-Z0-9]', '', dsp_label) or f'Dsp{index}'
+        dsp_name = dsp_name[0].upper() + dsp_name[1:].lower()
+        if dsp_name in dsp_names:
+            dsp_name += str(index)
+        dsp_names.append(dsp_name)
+        dsp_labels.append(dsp_label)
+
+        dsp_header = f'{op_type}_{dsp_name}.h' if bundle else f'{op_type}.h'
+        dsp_headers.append(dsp_header)
+
+        faust_options = []
+        if args.optimize:
+            faust_options = optimize(dsp_file, f'{op_type}_{dsp_name}' if bundle else op_type, libfaust_dir,
+                                     cmake_build_arch, args.sample_rate or TEMPLATE_SAMPLE_RATE,
+                                     args.block_size or TEMPLATE_BLOCK_SIZE)
+
+        # Turn the Faust code into C++ code:
+        run_faust(dsp_file, f'faust2touchdesigner/{dsp_header}', libfaust_dir, faust_options, json=True)
+
+        assert isfile(f'faust2touchdesigner/{dsp_header}')
+
+        # Specialize the generated code for a fixed sample rate and block size.
+        if args.sample_rate or args.block_size:
+            with open(f'faust2touchdesigner/{dsp_header}', 'r') as f:
+                code = f.read()
+            if args.sample_rate:
+                specialized = specialize_sample_rate(code, args.sample_rate,
+                                                     abspath(f'build_{op_type}_specialize/{dsp_name}'), libfaust_dir,
+                                                     cmake_build_arch)
+                if specialized is None:
+                    print(f'Warning: the constants of {dsp_file} could not be fixed at compile time.')
+                code = specialized or code
+            if args.block_size:
+                specialized = specialize_block_size(code, args.block_size)
+                if specialized is None:
+                    print(f'Warning: the compute() of {dsp_file} could not be specialized for a block size.')
+                code = specialized or code
+            with open(f'faust2touchdesigner/{dsp_header}', 'w') as f:
+                f.write(code)
+
+        json_file = dsp_file + '.json'
+        assert isfile(json_file), f"The JSON file wasn't found at {json_file}"
+
+        with open(json_file, 'r') as f:
+            text = f.readlines()
+
+            # hacky thing to fix invalid json
+            text = '\n'.join([line for line in text if '"library_list":' not in line and '"include_pathnames":' not in line])
+
+            j = json.loads(text)
+
+        ui_leaf_items = []
+
+        parse_ui(j['ui'], labels=[])
+
+        # remove duplicate addresses
+        addresses = set()
+        ui_leaf_items_copy = []
+        for item in ui_leaf_items:
+            if item['address'] not in addresses:
+                addresses.add(item['address'])
+                ui_leaf_items_copy.append(item)
+
+        ui_leaf_items = ui_leaf_items_copy
+        del ui_leaf_items_copy
+
+        if args.polyphonic:
+            ui_leaf_items = [item for item in ui_leaf_items
+                             if item['address'].split('/')[-1].lower() not in MIDI_VOICE_PARAMETERS]
+
+            # declare options "[midi:on][nvoices:8]";
+            for meta in j.get('meta', []):
+                match = re.search(r'\[nvoices:(\d+)\]', meta.get('options', ''))
+                if match and nvoices is None:
+                    nvoices = int(match.group(1))
+
+        prefix = dsp_name if bundle else ''
+        page = dsp_label if bundle else None
+
+        # Each parameter is bound to its zone when its DSP is selected, and the
+        # zone is only written when the parameter's value changes.
+        for item in ui_leaf_items:
+            address = item['address']
+            parname = item_to_td_parname(item, prefix)
+            widgettype = item['type']
+            if widgettype in ['hslider', 'vslider']:
+                parameters.append(f'{{{index}, "{parname}", "{address}", false}},')
+            elif widgettype in ['checkbox', 'button']:
+                parameters.append(f'{{{index}, "{parname}", "{address}", true}},')
+            elif widgettype == 'nentry':
+                parameters.append(f'{{{index}, "{parname}", "{address}", true}},')
+            elif widgettype in OUTPUT_WIDGET_TYPES:
+                pass
+            else:
+                raise ValueError(f"Unknown widget type: {widgettype}")
+
+        for item in ui_leaf_items:
+            widgettype = item['type']
+            if widgettype in ['hslider', 'vslider']:
+                setup_parameters.append(add_par_double(item, prefix, page))
+            elif widgettype == 'button':
+                setup_parameters.append(add_toggle(item, prefix, page))
+            elif widgettype == 'checkbox':
+                setup_parameters.append(add_toggle(item, prefix, page))
+            elif widgettype == 'nentry':
+                setup_parameters.append(add_nentry(item, prefix, page))
+            elif widgettype in OUTPUT_WIDGET_TYPES:
+                # todo: automatically build a UI for the user?
+                pass
+            else:
+                raise ValueError(f"Unkown ui widget type: {widgettype}")
+
+    parameters = '\n    '.join(parameters)
     setup_parameters = '\n'.join(setup_parameters)
 
+    # The list of DSP headers, see faust2touchdesigner/faustchop_isa_variant.cpp
+    with open(f'faust2touchdesigner/{op_type}_dsps.h', 'w') as f:
+        f.write('// Generated by faust2td.py: the DSPs in this plugin.\n')
+        for index, (dsp_name, dsp_header) in enumerate(zip(dsp_names, dsp_headers)):
+            f.write(f'FAUST_DSP_BEGIN({index}, "{dsp_name}")\n#include "{dsp_header}"\nFAUST_DSP_END({index})\n')
+
     with open('faust2touchdesigner/template_FaustCHOP.h', 'r') as f:
         template = f.read()
     template = template.replace('{OP_TYPE}', op_type)
@@ -303,7 +652,12 @@ if __name__ == '__main__':
     template = template.replace('{OP_ICON}', op_icon)
     template = template.replace('{AUTHOR_NAME}', author_name)
     template = template.replace('{AUTHOR_EMAIL}', author_email)
-    template = template.replace('{SET_PAR_VALUES}', set_par_values)
+    template = template.replace('{DSP_NAMES}', ', '.join(f'"{name}"' for name in dsp_names))
+    template = template.replace('{DSP_LABELS}', ', '.join('"' + label.replace('"', '\\"') + '"' for label in dsp_labels))
+    template = template.replace('{PARAMETERS}', parameters)
+    template = template.replace('{NVOICES}', str(nvoices or 8))
+    template = template.replace('{SAMPLE_RATE}', str(args.sample_rate))
+    template = template.replace('{BLOCK_SIZE}', str(args.block_size))
     template = template.replace('{SETUP_PARAMETERS}', setup_parameters)
 
     with open(f'faust2touchdesigner/Faust_{op_type}_CHOP.cpp', 'w') as f:
@@ -314,9 +668,29 @@ if __name__ == '__main__':
     # execute CMake and build
     build_dir = f'build_{op_type}'
     generator = " -G Xcode " if platform.system() == 'Darwin' else ''
-    subprocess.call(shlex.split(f'cmake faust2touchdesigner -B{build_dir} {generator} -DOP_TYPE={op_type} -DAUTHOR_NAME="{author_name}" -DLIBFAUST_DIR="{libfaust_dir}" {cmake_osx_deployment_target} {cmake_build_arch}'))
+    cmake_configure = shlex.split(f'cmake faust2touchdesigner -B{build_dir} {generator} -DOP_TYPE={op_type} -DAUTHOR_NAME="{author_name}" -DLIBFAUST_DIR="{libfaust_dir}" -DPOLYPHONY={"ON" if args.polyphonic else "OFF"} {cmake_osx_deployment_target} {cmake_build_arch}')
+
+    pgo = args.pgo
+    if pgo and platform.system() == 'Windows':
+        print('Warning: --pgo is not available with MSVC, building without it.')
+        pgo = False
+    if pgo:
+        pgo_dir = abspath(os.path.join(build_dir, 'pgo'))
+        bench_args = ['--sample-rates', str(args.sample_rate or TEMPLATE_SAMPLE_RATE),
+                      '--block-sizes', str(args.block_size or TEMPLATE_BLOCK_SIZE)]
+        bench_args += ['--trace', abspath(args.pgo_trace)] if args.pgo_trace else ['--randomize-every', '64']
+        bench_args += ['--input', abspath(args.pgo_input)] if args.pgo_input else []
+        pgo_before = pgo_train(cmake_configure, build_dir, op_type, len(dsp_names), bench_args, pgo_dir)
+        subprocess.call(cmake_configure + ['-DFAUST_PGO=USE', f'-DFAUST_PGO_DIR={pgo_dir}'])
+    else:
+        subprocess.call(cmake_configure + ['-DFAUST_PGO=OFF'])
     subprocess.call(shlex.split(f'cmake --build {build_dir} --config Release'))
 
+    if pgo:
+        pgo_after = [run_bench(build_dir, op_type, bench_args + ['--dsp', str(i)], os.path.join(pgo_dir, f'after_{i}.json'))
+                     for i in range(len(dsp_names))]
+        pgo_report(pgo_before, pgo_after, dsp_names, pgo_dir)
+
     if platform.system() == 'Darwin':
         file_dest = f'"{build_dir}/Release/{op_type}.plugin"'
         subprocess.call(shlex.split(f'cp -r {file_dest} Plugins'))
@@ -0,0 +1,416 @@
+// Headless benchmark of a faust2touchdesigner plugin, built next to it as
+// <OP_TYPE>_bench from the same generated DSPs and instruction set variants
+// (see CMakeLists.txt), so it measures exactly the code the CHOP runs.
+//
+// Runs compute() on white noise, or on a recorded input, for every
+// combination of block size and sample rate, optionally setting every
+// parameter to a random value within its range every few blocks or playing
+// a trace of parameter changes, and reports the cost per sample, the CPU load
+// at 48 kHz, the slowest block and the memory taken by the DSP.
+//
+// usage: <OP_TYPE>_bench [--dsp index] [--block-sizes 64,256,1024]
+//                        [--sample-rates 44100,48000,96000] [--seconds 10]
+//                        [--randomize-every blocks] [--seed n]
+//                        [--trace path] [--input path]
+//                        [--json path, or - for stdout]
+//
+// A trace is a text file with a parameter change per line: the time in
+// seconds, the parameter's Faust address and its value, for example
+// `1.5 /Reverb/damp 0.7`. Lines starting with # are ignored. An input is raw
+// 32-bit floats in the machine's byte order, with the DSP's input channels
+// interleaved, and is looped.
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+// after windows.h
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef FAUSTFLOAT
+#define FAUSTFLOAT float
+#endif
+
+#include <faust/gui/APIUI.h>
+
+#include "faustchop_isa.h"
+
+#define FAUSTCHOP_STR(x) #x
+#define FAUSTCHOP_XSTR(x) FAUSTCHOP_STR(x)
+
+using namespace std::chrono;
+
+namespace {
+
+struct Options {
+  int dsp = 0;
+  std::vector<int> blockSizes = {64, 256, 1024};
+  std::vector<int> sampleRates = {44100, 48000, 96000};
+  double seconds = 10.;
+  int randomizeEvery = 0;  // blocks; 0: keep the default values
+  unsigned seed = 1;
+  std::string trace;
+  std::string input;
+  std::string json;
+};
+
+struct TraceEvent {
+  double time;  // seconds
+  int parameter;
+  FAUSTFLOAT value;
+};
+
+struct Result {
+  int sampleRate;
+  int blockSize;
+  int64_t blocks;
+  double nsPerSample;
+  double cpuPercent48k;  // of one core, running at 48 kHz
+  double worstBlockUs;
+  double worstBlockPercent;  // of the block's duration
+};
+
+// Resident memory of this process in bytes, or -1.
+int64_t residentBytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))
+             ? (int64_t)counters.WorkingSetSize
+             : -1;
+#elif defined(__APPLE__)
+  mach_task_basic_info info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  return task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                   (task_info_t)&info, &count) == KERN_SUCCESS
+             ? (int64_t)info.resident_size
+             : -1;
+#else
+  long size = 0, resident = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return -1;
+  }
+  const int read = fscanf(statm, "%ld %ld", &size, &resident);
+  fclose(statm);
+  return read == 2 ? (int64_t)resident * sysconf(_SC_PAGESIZE) : -1;
+#endif
+}
+
+std::vector<int> parseList(const char* text) {
+  std::vector<int> values;
+  for (const char* p = text; *p;) {
+    char* end;
+    const long value = strtol(p, &end, 10);
+    if (end == p || value <= 0) {
+      return {};
+    }
+    values.push_back((int)value);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return values;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      return false;
+    }
+    i++;
+    if (arg == "--dsp") {
+      options.dsp = atoi(value);
+    } else if (arg == "--block-sizes") {
+      options.blockSizes = parseList(value);
+    } else if (arg == "--sample-rates") {
+      options.sampleRates = parseList(value);
+    } else if (arg == "--seconds") {
+      options.seconds = atof(value);
+    } else if (arg == "--randomize-every") {
+      options.randomizeEvery = std::max(0, atoi(value));
+    } else if (arg == "--seed") {
+      options.seed = (unsigned)strtoul(value, nullptr, 10);
+    } else if (arg == "--trace") {
+      options.trace = value;
+    } else if (arg == "--input") {
+      options.input = value;
+    } else if (arg == "--json") {
+      options.json = value;
+    } else {
+      return false;
+    }
+  }
+  return !options.blockSizes.empty() && !options.sampleRates.empty() &&
+         options.seconds > 0.;
+}
+
+// Every input parameter to a uniformly random value in its range; buttons
+// and checkboxes to 0 or 1.
+void randomize(APIUI& ui, std::mt19937& rng) {
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  for (int p = 0; p < ui.getParamsCount(); p++) {
+    switch (ui.getParamItemType(p)) {
+      case APIUI::kHBargraph:
+      case APIUI::kVBargraph:
+        break;
+      case APIUI::kButton:
+      case APIUI::kCheckButton:
+        ui.setParamValue(p, uniform(rng) < 0.5 ? 0 : 1);
+        break;
+      default: {
+        const double min = ui.getParamMin(p), max = ui.getParamMax(p);
+        ui.setParamValue(p, (FAUSTFLOAT)(min + uniform(rng) * (max - min)));
+      }
+    }
+  }
+}
+
+bool readTrace(const std::string& path, APIUI& ui,
+               std::vector<TraceEvent>& trace) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "Can't read %s.\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    char address[1024];
+    double time, value;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (sscanf(line.c_str(), "%lf %1023s %lf", &time, address, &value) != 3) {
+      fprintf(stderr, "%s:%d: expected <seconds> <address> <value>.\n",
+              path.c_str(), number);
+      return false;
+    }
+    const int parameter = ui.getParamIndex(address);
+    if (parameter < 0) {
+      fprintf(stderr, "%s:%d: there is no parameter %s.\n", path.c_str(),
+              number, address);
+      return false;
+    }
+    trace.push_back({time, parameter, (FAUSTFLOAT)value});
+  }
+  std::stable_sort(
+      trace.begin(), trace.end(),
+      [](const TraceEvent& a, const TraceEvent& b) { return a.time < b.time; });
+  return true;
+}
+
+bool readInput(const std::string& path, std::vector<float>& input) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    fprintf(stderr, "Can't read %s.\n", path.c_str());
+    return false;
+  }
+  input.resize((size_t)file.tellg() / sizeof(float));
+  file.seekg(0);
+  file.read((char*)input.data(), input.size() * sizeof(float));
+  return true;
+}
+
+Result run(dsp& faustDSP, APIUI& ui, const Options& options,
+           const std::vector<TraceEvent>& trace,
+           const std::vector<float>& recorded, int sampleRate, int blockSize) {
+  faustDSP.init(sampleRate);
+
+  std::mt19937 rng(options.seed);
+  std::uniform_real_distribution<FAUSTFLOAT> noise(-0.5, 0.5);
+  const int numInputs = faustDSP.getNumInputs();
+  std::vector<std::vector<FAUSTFLOAT>> inputs(numInputs),
+      outputs(faustDSP.getNumOutputs());
+  std::vector<FAUSTFLOAT*> inputPtrs, outputPtrs;
+  for (auto& input : inputs) {
+    input.resize(blockSize);
+    for (auto& sample : input) {
+      sample = noise(rng);
+    }
+    inputPtrs.push_back(input.data());
+  }
+  // The recorded input's frames, copied in before every block.
+  const size_t recordedFrames = numInputs ? recorded.size() / numInputs : 0;
+  size_t recordedFrame = 0;
+  for (auto& output : outputs) {
+    output.resize(blockSize);
+    outputPtrs.push_back(output.data());
+  }
+
+  // A tenth of a second to warm up the caches and branch predictors.
+  const int64_t warmupBlocks = std::max<int64_t>(1, sampleRate / 10 / blockSize);
+  for (int64_t block = 0; block < warmupBlocks; block++) {
+    faustDSP.compute(blockSize, inputPtrs.data(), outputPtrs.data());
+  }
+
+  const int64_t blocks = std::max<int64_t>(
+      1, (int64_t)std::ceil(options.seconds * sampleRate / blockSize));
+  double total = 0., worst = 0.;
+  size_t nextEvent = 0;
+  for (int64_t block = 0; block < blocks; block++) {
+    if (options.randomizeEvery && block % options.randomizeEvery == 0) {
+      randomize(ui, rng);
+    }
+    // The changes due before the end of this block.
+    const double blockEnd = (double)(block + 1) * blockSize / sampleRate;
+    for (; nextEvent < trace.size() && trace[nextEvent].time < blockEnd;
+         nextEvent++) {
+      ui.setParamValue(trace[nextEvent].parameter, trace[nextEvent].value);
+    }
+    if (recordedFrames) {
+      for (int i = 0; i < blockSize; i++) {
+        for (int chan = 0; chan < numInputs; chan++) {
+          inputs[chan][i] =
+              (FAUSTFLOAT)recorded[recordedFrame * numInputs + chan];
+        }
+        recordedFrame = (recordedFrame + 1) % recordedFrames;
+      }
+    }
+    const auto start = steady_clock::now();
+    faustDSP.compute(blockSize, inputPtrs.data(), outputPtrs.data());
+    const double ns =
+        duration<double, std::nano>(steady_clock::now() - start).count();
+    total += ns;
+    worst = std::max(worst, ns);
+  }
+
+  Result result;
+  result.sampleRate = sampleRate;
+  result.blockSize = blockSize;
+  result.blocks = blocks;
+  result.nsPerSample = total / ((double)blocks * blockSize);
+  result.cpuPercent48k = result.nsPerSample * 48000. / 1e9 * 100.;
+  result.worstBlockUs = worst / 1000.;
+  result.worstBlockPercent = worst / (1e9 * blockSize / sampleRate) * 100.;
+  return result;
+}
+
+void writeJSON(FILE* f, const char* dspName, FaustCHOPISA::Level isa,
+               dsp& faustDSP, int numParameters, int64_t instanceBytes,
+               int64_t resident, const Options& options,
+               const std::vector<Result>& results) {
+  fprintf(f, "{\n");
+  fprintf(f, "  \"plugin\": \"%s\",\n", FAUSTCHOP_XSTR(OP_TYPE));
+  fprintf(f, "  \"dsp\": \"%s\",\n", dspName);
+  fprintf(f, "  \"isa\": \"%s\",\n", FaustCHOPISA::name(isa));
+  fprintf(f, "  \"inputs\": %d,\n", faustDSP.getNumInputs());
+  fprintf(f, "  \"outputs\": %d,\n", faustDSP.getNumOutputs());
+  fprintf(f, "  \"parameters\": %d,\n", numParameters);
+  fprintf(f, "  \"randomize_every\": %d,\n", options.randomizeEvery);
+  fprintf(f, "  \"seed\": %u,\n", options.seed);
+  fprintf(f, "  \"instance_bytes\": %lld,\n", (long long)instanceBytes);
+  fprintf(f, "  \"resident_bytes\": %lld,\n", (long long)resident);
+  fprintf(f, "  \"results\": [");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    fprintf(f,
+            "%s\n    {\"sample_rate\": %d, \"block_size\": %d, "
+            "\"blocks\": %lld, \"ns_per_sample\": %.4f, "
+            "\"cpu_percent_48k\": %.4f, \"worst_block_us\": %.3f, "
+            "\"worst_block_percent\": %.3f}",
+            i ? "," : "", r.sampleRate, r.blockSize, (long long)r.blocks,
+            r.nsPerSample, r.cpuPercent48k, r.worstBlockUs,
+            r.worstBlockPercent);
+  }
+  fprintf(f, "\n  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    fprintf(stderr,
+            "usage: %s [--dsp index] [--block-sizes 64,256,1024]\n"
+            "       [--sample-rates 44100,48000,96000] [--seconds 10]\n"
+            "       [--randomize-every blocks] [--seed n] [--trace path]\n"
+            "       [--input path] [--json path|-]\n",
+            argv[0]);
+    return 2;
+  }
+  const char* dspName = FaustCHOPISA::dspName(options.dsp);
+  if (options.dsp < 0 || !dspName) {
+    fprintf(stderr, "There is no DSP %d in %s.\n", options.dsp,
+            FAUSTCHOP_XSTR(OP_TYPE));
+    return 2;
+  }
+
+  // Resident memory grows by the instance, the static tables its class
+  // initializes and the user interface, rounded to pages.
+  const int64_t residentBefore = residentBytes();
+  FaustCHOPISA::Level isa;
+  std::unique_ptr<dsp> faustDSP(FaustCHOPISA::create(isa, options.dsp));
+  faustDSP->init(options.sampleRates[0]);
+  APIUI ui;
+  faustDSP->buildUserInterface(&ui);
+  const int64_t residentAfter = residentBytes();
+  const int64_t resident = residentBefore >= 0 && residentAfter >= 0
+                               ? residentAfter - residentBefore
+                               : -1;
+  const int64_t instanceBytes = (int64_t)FaustCHOPISA::dspSize(options.dsp);
+
+  std::vector<TraceEvent> trace;
+  std::vector<float> recorded;
+  if ((!options.trace.empty() && !readTrace(options.trace, ui, trace)) ||
+      (!options.input.empty() && !readInput(options.input, recorded))) {
+    return 1;
+  }
+
+  const bool quiet = options.json == "-";
+  if (!quiet) {
+    printf("%s: %s (%s), %d in, %d out, %d parameters\n",
+           FAUSTCHOP_XSTR(OP_TYPE), dspName, FaustCHOPISA::name(isa),
+           faustDSP->getNumInputs(), faustDSP->getNumOutputs(),
+           ui.getParamsCount());
+    printf("instance %lld bytes, resident %lld bytes\n\n",
+           (long long)instanceBytes, (long long)resident);
+    printf("%8s %6s %12s %10s %14s %10s\n", "rate", "block", "ns/sample",
+           "cpu@48k %", "worst block us", "of block %");
+  }
+
+  std::vector<Result> results;
+  for (int sampleRate : options.sampleRates) {
+    for (int blockSize : options.blockSizes) {
+      results.push_back(run(*faustDSP, ui, options, trace, recorded,
+                            sampleRate, blockSize));
+      const Result& r = results.back();
+      if (!quiet) {
+        printf("%8d %6d %12.3f %10.3f %14.2f %10.2f\n", r.sampleRate,
+               r.blockSize, r.nsPerSample, r.cpuPercent48k, r.worstBlockUs,
+               r.worstBlockPercent);
+        fflush(stdout);
+      }
+    }
+  }
+
+  if (!options.json.empty()) {
+    FILE* f = quiet ? stdout : fopen(options.json.c_str(), "w");
+    if (!f) {
+      fprintf(stderr, "Can't write %s.\n", options.json.c_str());
+      return 1;
+    }
+    writeJSON(f, dspName, isa, *faustDSP, ui.getParamsCount(), instanceBytes,
+              resident, options, results);
+    if (!quiet) {
+      fclose(f);
+    }
+  }
+  return 0;
+}
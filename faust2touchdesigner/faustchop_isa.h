@@ -0,0 +1,133 @@
+#pragma once
+
+#include <faust/dsp/dsp.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+// One factory per variant of the generated DSPs that CMakeLists.txt compiled
+// (see faustchop_isa_variant.cpp), taking the index of a DSP in the plugin.
+namespace faust_isa_generic {
+dsp* createFaustDSP(int index);
+const char* getFaustDSPName(int index);
+size_t getFaustDSPSize(int index);
+}
+#ifdef FAUST_ISA_SSE4
+namespace faust_isa_sse4 {
+dsp* createFaustDSP(int index);
+}
+#endif
+#ifdef FAUST_ISA_AVX2
+namespace faust_isa_avx2 {
+dsp* createFaustDSP(int index);
+}
+#endif
+#ifdef FAUST_ISA_AVX512
+namespace faust_isa_avx512 {
+dsp* createFaustDSP(int index);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// name: class FaustCHOPISA
+// desc: Picks the variant of the generated DSP for the newest instruction set
+//       that both the plugin was built with and the CPU supports, so one
+//       plugin runs everywhere and still uses AVX2/AVX-512 where it can.
+//-----------------------------------------------------------------------------
+class FaustCHOPISA {
+ public:
+  enum Level { kGeneric = 0, kSSE4, kAVX2, kAVX512 };
+
+  static const char* name(Level level) {
+    switch (level) {
+      case kSSE4:
+        return "sse4.2";
+      case kAVX2:
+        return "avx2";
+      case kAVX512:
+        return "avx512";
+      default:
+        return "generic";
+    }
+  }
+
+  // The newest level this CPU and OS support.
+  static Level detect() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int regs[4];
+    __cpuid(regs, 0);
+    const int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    const bool sse42 = regs[2] & (1 << 20);
+    const bool fma = regs[2] & (1 << 12);
+    const bool osxsave = regs[2] & (1 << 27);
+    // The OS must save the YMM (and ZMM) registers on context switches.
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool ymm = (xcr0 & 0x6) == 0x6;
+    const bool zmm = (xcr0 & 0xe6) == 0xe6;
+    int ebx = 0;
+    if (maxLeaf >= 7) {
+      __cpuidex(regs, 7, 0);
+      ebx = regs[1];
+    }
+    const bool avx2 = ymm && fma && (ebx & (1 << 5));
+    // F, DQ, BW and VL
+    const int avx512Bits = (1 << 16) | (1 << 17) | (1 << 30) | (1 << 31);
+    const bool avx512 = avx2 && zmm && (ebx & avx512Bits) == avx512Bits;
+#elif (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+    // These also check that the OS saves the wider registers.
+    __builtin_cpu_init();
+    const bool sse42 = __builtin_cpu_supports("sse4.2");
+    const bool avx2 =
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    const bool avx512 = avx2 && __builtin_cpu_supports("avx512f") &&
+                        __builtin_cpu_supports("avx512dq") &&
+                        __builtin_cpu_supports("avx512bw") &&
+                        __builtin_cpu_supports("avx512vl");
+#else
+    const bool sse42 = false, avx2 = false, avx512 = false;
+#endif
+    return avx512 ? kAVX512 : avx2 ? kAVX2 : sse42 ? kSSE4 : kGeneric;
+  }
+
+  // Name of DSP `index` of the plugin (its file name without extension), or
+  // nullptr past the last one.
+  static const char* dspName(int index) {
+    return faust_isa_generic::getFaustDSPName(index);
+  }
+
+  // Size of an instance of DSP `index`, not counting its static tables.
+  static size_t dspSize(int index) {
+    return faust_isa_generic::getFaustDSPSize(index);
+  }
+
+  // Create DSP `index` of the plugin for the best available level, which is
+  // stored in `level`. nullptr if there is no such DSP.
+  static dsp* create(Level& level, int index) {
+    const Level cpu = detect();
+#ifdef FAUST_ISA_AVX512
+    if (cpu >= kAVX512) {
+      level = kAVX512;
+      return faust_isa_avx512::createFaustDSP(index);
+    }
+#endif
+#ifdef FAUST_ISA_AVX2
+    if (cpu >= kAVX2) {
+      level = kAVX2;
+      return faust_isa_avx2::createFaustDSP(index);
+    }
+#endif
+#ifdef FAUST_ISA_SSE4
+    if (cpu >= kSSE4) {
+      level = kSSE4;
+      return faust_isa_sse4::createFaustDSP(index);
+    }
+#endif
+    (void)cpu;
+    level = kGeneric;
+    return faust_isa_generic::createFaustDSP(index);
+  }
+};
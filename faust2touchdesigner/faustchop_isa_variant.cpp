@@ -0,0 +1,70 @@
+// Compiled once per instruction set level by CMakeLists.txt, with
+// FAUST_ISA_NAMESPACE naming the namespace of this variant, FAUST_DSP_LIST
+// the list of DSP headers generated by faust2td.py, and the level's code
+// generation flags.
+
+// The generated headers start with the architecture file's includes. They
+// are all guarded, so including them here first keeps them out of the
+// namespaces below.
+#include <math.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "template_faustaudio.h"
+
+namespace FAUST_ISA_NAMESPACE {
+
+// Every DSP goes in a namespace of its own, so they can all be called
+// FaustDSP.
+#define FAUST_DSP_BEGIN(index, name) namespace dsp##index {
+#define FAUST_DSP_END(index) \
+  dsp* createFaustDSP() { return new FaustDSP(); } }
+
+#include FAUST_DSP_LIST
+
+#undef FAUST_DSP_BEGIN
+#undef FAUST_DSP_END
+
+// The list again in each function below, now only for the indices and
+// names: the headers have `#pragma once`.
+#define FAUST_DSP_END(index)
+
+dsp* createFaustDSP(int index) {
+  switch (index) {
+#define FAUST_DSP_BEGIN(index, name) \
+  case index:                        \
+    return dsp##index::createFaustDSP();
+#include FAUST_DSP_LIST
+#undef FAUST_DSP_BEGIN
+    default:
+      return nullptr;
+  }
+}
+
+const char* getFaustDSPName(int index) {
+  switch (index) {
+#define FAUST_DSP_BEGIN(index, name) \
+  case index:                        \
+    return name;
+#include FAUST_DSP_LIST
+#undef FAUST_DSP_BEGIN
+    default:
+      return nullptr;
+  }
+}
+
+size_t getFaustDSPSize(int index) {
+  switch (index) {
+#define FAUST_DSP_BEGIN(index, name) \
+  case index:                        \
+    return sizeof(dsp##index::FaustDSP);
+#include FAUST_DSP_LIST
+#undef FAUST_DSP_BEGIN
+    default:
+      return 0;
+  }
+}
+
+}  // namespace FAUST_ISA_NAMESPACE
@@ -0,0 +1,32 @@
+// Prints the constants a generated FaustDSP computes in instanceConstants(),
+// for `faust2td.py --sample-rate`, which writes them back into the class as
+// compile-time constants. FaustDSPConstants.h has a FAUST_CONSTANT(name) line
+// per constant.
+//
+// usage: faustchop_constants <sample rate>
+// prints: <name> <value as a hexadecimal float>, one constant per line
+
+#include <math.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "FaustDSP.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    return 2;
+  }
+  FaustDSP dsp;
+  dsp.instanceConstants(atoi(argv[1]));
+
+  // Hexadecimal floats keep every bit, and every float and int is exactly a
+  // double.
+#define FAUST_CONSTANT(name) printf(#name " %a\n", (double)dsp.name);
+#include "FaustDSPConstants.h"
+#undef FAUST_CONSTANT
+  return 0;
+}
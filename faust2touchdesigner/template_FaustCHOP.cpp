@@ -19,6 +19,7 @@
 #include <limits.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <cmath>
 #include <filesystem>
 #include <fstream>
@@ -45,6 +46,37 @@ using namespace std;
   } while (0)
 #endif
 
+// The DSPs in this plugin (see {OP_TYPE}_dsps.h) and the parameters that drive
+// them. The parameters of the DSPs that aren't selected are disabled.
+static const char* kDSPNames[] = {{DSP_NAMES}};
+static const char* kDSPLabels[] = {{DSP_LABELS}};
+static const int kNumDSPs = (int)(sizeof(kDSPNames) / sizeof(kDSPNames[0]));
+
+struct DSPParameter {
+  int dsp;
+  const char* name;
+  const char* address;
+  bool isInt;
+};
+static const DSPParameter kParameters[] = {
+    {PARAMETERS}
+    {-1, nullptr, nullptr, false}};
+
+// Default of the Nvoices parameter, from the DSP's [nvoices:N] option.
+static const int kDefaultVoices = {NVOICES};
+
+// The sample rate and block size the DSPs were specialized for by
+// faust2td.py --sample-rate and --block-size, or 0. The constants of the
+// DSPs are only right at that sample rate, and compute() is fastest with
+// blocks of that size.
+static const int kFixedSampleRate = {SAMPLE_RATE};
+static const int kFixedBlockSize = {BLOCK_SIZE};
+
+#ifdef FAUSTCHOP_POLYPHONY
+std::list<GUI*> GUI::fGuiList;
+ztimedmap GUI::gTimedZoneMap;
+#endif
+
 // These functions are basic C function, which the DLL loader can find
 // much easier than finding a C++ Class.
 // The DLLEXPORT prefix is needed so the compile exports these functions from
@@ -70,7 +102,12 @@ void FillCHOPPluginInfo(CHOP_PluginInfo* info) {
   info->customOPInfo.authorEmail->setString("{AUTHOR_EMAIL}");
 
   info->customOPInfo.minInputs = 0;
+#ifdef FAUSTCHOP_POLYPHONY
+  // The second input is a MIDI CHOP playing the voices.
+  info->customOPInfo.maxInputs = 2;
+#else
   info->customOPInfo.maxInputs = 1;
+#endif
 
   // info->customOPInfo.pythonVersion->setString(PY_VERSION);
   // info->customOPInfo.pythonMethods = methods;
@@ -95,19 +132,36 @@ void DestroyCHOPInstance(CHOP_CPlusPlusBase* instance) {
 
 FaustCHOP::FaustCHOP(const OP_NodeInfo* info) : m_NodeInfo(info) {
   // sample rate
-  m_srate = 44100.;  // will be written immediately by getOutputInfo
-
-  m_dsp.init(m_srate);
-  m_dsp.buildUserInterface(&m_ui);  // todo:
+  m_srate = kFixedSampleRate ? kFixedSampleRate
+                             : 44100.;  // will be written immediately by
+                                        // getOutputInfo
 
   // zero
   m_input = NULL;
   m_output = NULL;
-  // default
-  m_numInputChannels = m_dsp.getNumInputs();
-  m_numOutputChannels = m_dsp.getNumOutputs();
 
-  this->allocate(m_numInputChannels, m_numOutputChannels, m_blockSize);
+  m_nvoices = kDefaultVoices;
+
+  selectDSP(0);
+}
+
+void FaustCHOP::selectDSP(int index) {
+  m_dspIndex = index;
+  dsp* voice = FaustCHOPISA::create(m_isa, index);
+#ifdef FAUSTCHOP_POLYPHONY
+  // The poly DSP owns the voice and clones it for the others. Notes still
+  // held on the MIDI input are played again on the new voices.
+  m_poly = new FaustCHOPPoly(voice, m_nvoices, m_dynamicVoices, m_groupVoices);
+  voice = m_poly;
+  m_midiInput.clear();
+#endif
+  m_dsp.reset(voice);
+  m_dsp->init(m_srate);
+  m_ui = std::make_unique<APIUI>();
+  m_dsp->buildUserInterface(m_ui.get());
+  bindParameters();
+
+  this->allocate(m_dsp->getNumInputs(), m_dsp->getNumOutputs(), m_blockSize);
 }
 
 FaustCHOP::~FaustCHOP() {
@@ -131,6 +185,35 @@ bool FaustCHOP::getOutputInfo(CHOP_OutputInfo* info, const OP_Inputs* inputs,
   // If there is an input connected, we are going to match it's channel names
   // etc otherwise we'll specify our own.
 
+  int index = kNumDSPs > 1
+                  ? std::clamp<int>(inputs->getParInt("Dsp"), 0, kNumDSPs - 1)
+                  : 0;
+  bool needRebuild = index != m_dspIndex;
+#ifdef FAUSTCHOP_POLYPHONY
+  int nvoices = inputs->getParInt("Nvoices");
+  bool groupVoices = inputs->getParInt("Groupvoices");
+  bool dynamicVoices = inputs->getParInt("Dynamicvoices");
+  if (nvoices != m_nvoices || groupVoices != m_groupVoices ||
+      dynamicVoices != m_dynamicVoices) {
+    m_nvoices = nvoices;
+    m_groupVoices = groupVoices;
+    m_dynamicVoices = dynamicVoices;
+    needRebuild = true;
+  }
+#endif
+  if (needRebuild) {
+    selectDSP(index);
+  }
+
+  if (kNumDSPs > 1) {
+    if (m_enabledDSP != m_dspIndex) {
+      for (const DSPParameter* p = kParameters; p->dsp >= 0; p++) {
+        inputs->enablePar(p->name, p->dsp == m_dspIndex);
+      }
+      m_enabledDSP = m_dspIndex;
+    }
+  }
+
   info->numChannels = m_numOutputChannels;
 
   // Since we are outputting a timeslice, the system will dictate
@@ -143,9 +226,13 @@ bool FaustCHOP::getOutputInfo(CHOP_OutputInfo* info, const OP_Inputs* inputs,
   bool needRecompile = m_srate != info->sampleRate;
   m_srate = info->sampleRate;
 
-  if (needRecompile) {
-    m_dsp.init(m_srate);
-    m_dsp.buildUserInterface(&m_ui);
+  // A specialized DSP's constants don't depend on the rate, so there is
+  // nothing to do; execute() reports the mismatch.
+  if (needRecompile && !kFixedSampleRate) {
+    // init() resets every zone to its default, so write them all again on the
+    // next cook. The zones themselves don't move.
+    m_dsp->init(m_srate);
+    invalidateParameters();
   }
 
   return true;
@@ -199,6 +286,53 @@ void FaustCHOP::allocate(int inputChannels, int outputChannels,
   }
 }
 
+void FaustCHOP::bindParameter(const char* name, const char* address,
+                              bool isInt) {
+  // Polyphonic DSPs put the voices' controls in groups, so match the end of
+  // the path. Ungrouped voices each have a zone, and the parameter drives
+  // them all.
+  const size_t length = strlen(address);
+  for (int index = 0; index < m_ui->getParamsCount(); index++) {
+    const char* path = m_ui->getParamAddress(index);
+    const size_t pathLength = strlen(path);
+    if (pathLength >= length &&
+        !strcmp(path + pathLength - length, address)) {
+      m_parameters.push_back(
+          {name, m_ui->getParamZone(index), isInt, std::nan("")});
+    }
+  }
+}
+
+void FaustCHOP::bindParameters() {
+  m_parameters.clear();
+  for (const DSPParameter* p = kParameters; p->dsp >= 0; p++) {
+    if (p->dsp == m_dspIndex) {
+      bindParameter(p->name, p->address, p->isInt);
+    }
+  }
+}
+
+void FaustCHOP::invalidateParameters() {
+  for (auto& parameter : m_parameters) {
+    parameter.value = std::nan("");
+  }
+}
+
+bool FaustCHOP::updateParameters(const OP_Inputs* inputs) {
+  bool changed = false;
+  for (auto& parameter : m_parameters) {
+    double value = parameter.isInt ? inputs->getParInt(parameter.name)
+                                   : inputs->getParDouble(parameter.name);
+    // NaN never compares equal, so invalidated parameters are always written.
+    if (value != parameter.value) {
+      *parameter.zone = (FAUSTFLOAT)value;
+      parameter.value = value;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
 void FaustCHOP::getWarningString(OP_String* warning, void* reserved1) {
   warning->setString(m_warningString.c_str());
 }
@@ -211,7 +345,15 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
                         void* reserved) {
   m_warningString = std::string("");
 
-  {SET_PAR_VALUES}
+  bool parametersChanged = updateParameters(inputs);
+#ifdef FAUSTCHOP_POLYPHONY
+  // Grouped voices copy the group's controls when Faust updates the GUIs.
+  if (parametersChanged && m_groupVoices) {
+    GUI::updateAllGuis();
+  }
+#else
+  (void)parametersChanged;
+#endif
 
   if (output->numChannels == 0 || output->numChannels != m_numOutputChannels) {
     // write zeros and return
@@ -235,9 +377,21 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
     return;
   }
 
+  if (kFixedSampleRate && m_srate != kFixedSampleRate) {
+    for (int chan = 0; chan < output->numChannels; chan++) {
+      memset(output->channels[chan], 0, output->numSamples * sizeof(float));
+    }
+    std::stringstream ss;
+    ss << "This CHOP was built for a sample rate of " << kFixedSampleRate
+       << " Hz (faust2td.py --sample-rate), but its Sample Rate is "
+       << m_srate << " Hz.";
+    m_errorString = ss.str();
+    return;
+  }
+
   // A reasonably large block size. Code farther below will make it smaller when
   // polyphony is necessary, or the control signals are high audio rate.
-  m_blockSize = 1024;
+  m_blockSize = kFixedBlockSize ? kFixedBlockSize : 1024;
 
   if (m_blockSize > m_allocatedSamples) {
     allocate(m_numInputChannels, m_numOutputChannels, m_blockSize);
@@ -266,9 +420,27 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
 
   int chan = 0;
 
-  for (int i = 0; i < output->numSamples; i += m_blockSize) {
+#ifdef FAUSTCHOP_POLYPHONY
+  m_midiEvents.clear();
+  m_midiInput.diff(inputs->getInputCHOP(1), output->numSamples, m_midiEvents);
+  size_t nextMidiEvent = 0;
+#endif
+
+  for (int i = 0; i < output->numSamples; i += numSamples) {
     numSamples = min(output->numSamples - i, m_blockSize);
 
+#ifdef FAUSTCHOP_POLYPHONY
+    // Dispatch the MIDI events that are due, then end this block where the
+    // next one starts so that it lands on its sample.
+    while (nextMidiEvent < m_midiEvents.size() &&
+           m_midiEvents[nextMidiEvent].offset <= i) {
+      m_midiEvents[nextMidiEvent++].dispatch(m_poly);
+    }
+    if (nextMidiEvent < m_midiEvents.size()) {
+      numSamples = min(numSamples, m_midiEvents[nextMidiEvent].offset - i);
+    }
+#endif
+
     if (audioInput) {
       for (chan = 0; chan < min(m_numInputChannels, audioInput->numChannels);
            chan++) {
@@ -289,7 +461,7 @@ void FaustCHOP::execute(CHOP_Output* output, const OP_Inputs* inputs,
 
     // auto start = high_resolution_clock::now();
 
-    m_dsp.compute(numSamples, m_input, m_output);
+    m_dsp->compute(numSamples, m_input, m_output);
 
     // auto stop = high_resolution_clock::now();
     // m_duration = duration_cast<microseconds>(stop - start);
@@ -308,7 +480,7 @@ int32_t FaustCHOP::getNumInfoCHOPChans(void* reserved1) {
   // connected to the CHOP. In this example we are just going to send one
   // channel.
 
-  int numChans = 2;
+  int numChans = 4;
 
   return numChans;
 }
@@ -324,12 +496,19 @@ void FaustCHOP::getInfoCHOPChan(int32_t index, OP_InfoCHOPChan* chan,
   } else if (index == 1) {
     chan->name->setString("block_size");
     chan->value = m_blockSize;
+  } else if (index == 2) {
+    // see FaustCHOPISA::Level, and the Info DAT for its name
+    chan->name->setString("isa");
+    chan->value = m_isa;
+  } else if (index == 3) {
+    chan->name->setString("dsp");
+    chan->value = m_dspIndex;
   } else {
   }
 }
 
 bool FaustCHOP::getInfoDATSize(OP_InfoDATSize* infoSize, void* reserved1) {
-  infoSize->rows = 0;
+  infoSize->rows = 2;
   infoSize->cols = 2;
   // Setting this to false means we'll be assigning values to the table
   // one row at a time. True means we'll do it one column at a time.
@@ -339,20 +518,13 @@ bool FaustCHOP::getInfoDATSize(OP_InfoDATSize* infoSize, void* reserved1) {
 
 void FaustCHOP::getInfoDATEntries(int32_t index, int32_t nEntries,
                                   OP_InfoDATEntries* entries, void* reserved1) {
-//   char tempBuffer[4096];
-
-//   if (index == 0) {
-//     // Set the value for the first column
-//     entries->values[0]->setString("foo");
-
-//     // Set the value for the second column
-// #ifdef _WIN32
-//     sprintf_s(tempBuffer, "%d", foo);
-// #else  // macOS
-//     snprintf(tempBuffer, sizeof(tempBuffer), "%d", foo);
-// #endif
-//     entries->values[1]->setString(tempBuffer);
-//   }
+  if (index == 0) {
+    entries->values[0]->setString("isa");
+    entries->values[1]->setString(FaustCHOPISA::name(m_isa));
+  } else if (index == 1) {
+    entries->values[0]->setString("dsp");
+    entries->values[1]->setString(kDSPLabels[m_dspIndex]);
+  }
 }
 
 void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
@@ -362,7 +534,7 @@ void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
 
     np.name = "Samplerate";
     np.label = "Sample Rate";
-    np.defaultValues[0] = 44100.0;
+    np.defaultValues[0] = kFixedSampleRate ? kFixedSampleRate : 44100.0;
     np.minSliders[0] = np.minValues[0] = .001;
     np.maxSliders[0] = np.maxValues[0] = 192000.0;
     np.clampMins[0] = np.clampMaxes[0] = true;
@@ -371,6 +543,62 @@ void FaustCHOP::setupParameters(OP_ParameterManager* manager, void* reserved1) {
     assert(res == OP_ParAppendResult::Success);
   }
 
+#ifdef FAUSTCHOP_POLYPHONY
+  // Polyphony N Voices
+  {
+    OP_NumericParameter np;
+    np.name = "Nvoices";
+    np.label = "N Voices";
+    np.defaultValues[0] = kDefaultVoices;
+    np.minSliders[0] = 1.;
+    np.maxSliders[0] = 16.;
+    np.minValues[0] = 1.;
+    np.maxValues[0] = 512.;
+    np.clampMins[0] = true;
+    np.clampMaxes[0] = true;
+
+    OP_ParAppendResult res = manager->appendInt(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Group voices
+  {
+    OP_NumericParameter np;
+
+    np.name = "Groupvoices";
+    np.label = "Group Voices";
+    np.defaultValues[0] = true;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
+  // Dynamic voices
+  {
+    OP_NumericParameter np;
+
+    np.name = "Dynamicvoices";
+    np.label = "Dynamic Voices";
+    np.defaultValues[0] = true;
+
+    OP_ParAppendResult res = manager->appendToggle(np);
+    assert(res == OP_ParAppendResult::Success);
+  }
+#endif
+
+  // DSP
+  if (kNumDSPs > 1) {
+    OP_StringParameter sp;
+
+    sp.name = "Dsp";
+    sp.label = "DSP";
+    sp.defaultValue = kDSPNames[0];
+
+    OP_ParAppendResult res =
+        manager->appendMenu(sp, kNumDSPs, kDSPNames, kDSPLabels);
+    assert(res == OP_ParAppendResult::Success);
+  }
+
   {SETUP_PARAMETERS}
 }
 
@@ -15,6 +15,8 @@
 #include "CHOP_CPlusPlusBase.h"
 using namespace TD;
 #include <iostream>
+#include <memory>
+#include <vector>
 
 //#include <chrono>
 // using namespace std::chrono;
@@ -30,10 +32,17 @@ using namespace TD;
 #define MAX_OUTPUTS 16384
 #endif
 
-#include "{OP_TYPE}.h"
-
 #include <faust/gui/APIUI.h>
 
+#include "faustchop_isa.h"
+
+// Built with faust2td.py --polyphonic, which shares the voice allocation and
+// MIDI input of the TD-Faust CHOP.
+#ifdef FAUSTCHOP_POLYPHONY
+#include "faustchop_midi.h"
+#include "faustchop_poly.h"
+#endif
+
 using namespace std;
 
 // To get more help about these functions, look at CHOP_CPlusPlusBase.h
@@ -72,6 +81,24 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
   void allocate(int inputChannels, int outputChannels, int numSamples);
 
  private:
+  // Create DSP `index` of the plugin and its UI, and bind its parameters.
+  void selectDSP(int index);
+
+  // A TouchDesigner parameter and the zone it drives, resolved once by
+  // bindParameters() so that cooking doesn't look up Faust paths.
+  struct ParameterBinding {
+    const char* name;
+    FAUSTFLOAT* zone;
+    bool isInt;
+    double value;  // last value written to the zone, NaN to force a write
+  };
+
+  void bindParameter(const char* name, const char* address, bool isInt);
+  void bindParameters();
+  void invalidateParameters();
+  // Write the parameters that changed to their zones, true if any did.
+  bool updateParameters(const OP_Inputs* inputs);
+
   // We don't need to store this pointer, but we do for the example.
   // The OP_NodeInfo class store information about the node that's using
   // this instance of the class (like its name).
@@ -99,7 +126,24 @@ class FaustCHOP : public CHOP_CPlusPlusBase {
   // diagnostic vars:
   int m_blockSize = 0;
 
-  FaustDSP m_dsp;
-
-  APIUI m_ui;
+  // the selected generated DSP, compiled for m_isa
+  std::unique_ptr<dsp> m_dsp;
+  int m_dspIndex = 0;
+  FaustCHOPISA::Level m_isa = FaustCHOPISA::kGeneric;
+  // the DSP whose parameters are enabled, -1 before the first cook
+  int m_enabledDSP = -1;
+
+  std::unique_ptr<APIUI> m_ui;
+  std::vector<ParameterBinding> m_parameters;
+
+  // polyphony, see selectDSP()
+  int m_nvoices = 0;
+  bool m_groupVoices = true;
+  bool m_dynamicVoices = true;
+#ifdef FAUSTCHOP_POLYPHONY
+  // the voices, owned by m_dsp
+  FaustCHOPPoly* m_poly = nullptr;
+  FaustCHOPMidiInput m_midiInput;
+  std::vector<FaustCHOPMidiEvent> m_midiEvents;
+#endif
 };
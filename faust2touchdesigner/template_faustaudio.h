@@ -11,12 +11,19 @@
 #define FAUSTFLOAT float
 #endif
 
-struct UI;
-struct Meta;
-
 #include <faust/dsp/dsp.h>
 #include <faust/gui/DecoratorUI.h>
 #include <faust/gui/MapUI.h>
 #include <faust/gui/LayoutUI.h>
 #include <faust/gui/ValueConverter.h>
 #include <faust/misc.h>
+
+// faust2td.py --block-size inlines the generated compute() into a copy with a
+// constant block size.
+#ifndef FAUSTCHOP_ALWAYS_INLINE
+#if defined(_MSC_VER)
+#define FAUSTCHOP_ALWAYS_INLINE __forceinline
+#else
+#define FAUSTCHOP_ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+#endif
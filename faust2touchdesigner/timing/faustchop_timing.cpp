@@ -0,0 +1,88 @@
+// Times the compute() of a generated FaustDSP on white noise, for
+// `faust2td.py --optimize`. FAUST_DSP_HEADER names the header to time.
+//
+// usage: faustchop_timing [sample rate] [block size]
+// prints: <ns per sample> <output RMS>
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include FAUST_DSP_HEADER
+
+int main(int argc, char** argv) {
+  const int sampleRate = argc > 1 ? atoi(argv[1]) : 44100;
+  const int blockSize = std::max(1, argc > 2 ? atoi(argv[2]) : 1024);
+  const int runs = 5;
+  const auto runTime = std::chrono::milliseconds(100);
+
+  FaustDSP dsp;
+  dsp.init(sampleRate);
+
+  const int numInputs = dsp.getNumInputs();
+  const int numOutputs = dsp.getNumOutputs();
+  std::vector<std::vector<FAUSTFLOAT>> inputs(numInputs), outputs(numOutputs);
+  std::vector<FAUSTFLOAT*> inputPtrs, outputPtrs;
+  uint32_t seed = 1;
+  for (auto& input : inputs) {
+    input.resize(blockSize);
+    for (auto& sample : input) {
+      seed = seed * 1664525u + 1013904223u;
+      sample = (FAUSTFLOAT)((double)seed / 4294967296. - 0.5);
+    }
+    inputPtrs.push_back(input.data());
+  }
+  for (auto& output : outputs) {
+    output.resize(blockSize);
+    outputPtrs.push_back(output.data());
+  }
+
+  // Warm up once, then keep the fastest run, which is the least disturbed by
+  // the rest of the machine.
+  double best = INFINITY;
+  for (int run = 0; run <= runs; run++) {
+    int64_t samples = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto now = start;
+    do {
+      for (int i = 0; i < 16; i++) {
+        dsp.compute(blockSize, inputPtrs.data(), outputPtrs.data());
+      }
+      samples += 16 * (int64_t)blockSize;
+      now = std::chrono::steady_clock::now();
+    } while (now - start < runTime);
+    if (run > 0) {
+      const double ns =
+          std::chrono::duration<double, std::nano>(now - start).count();
+      best = std::min(best, ns / samples);
+    }
+  }
+
+  // Lets the report flag variants that compute something different. The
+  // timed runs have no fixed length, so start again from a fresh state.
+  const int checkBlocks = 8;
+  dsp.init(sampleRate);
+  double sum = 0.;
+  for (int block = 0; block < checkBlocks; block++) {
+    dsp.compute(blockSize, inputPtrs.data(), outputPtrs.data());
+    for (auto& output : outputs) {
+      for (FAUSTFLOAT sample : output) {
+        sum += (double)sample * sample;
+      }
+    }
+  }
+  const double rms =
+      numOutputs
+          ? std::sqrt(sum / ((double)numOutputs * checkBlocks * blockSize))
+          : 0.;
+
+  printf("%.4f %.6g\n", best, rms);
+  return 0;
+}
@@ -0,0 +1,311 @@
+// Loads a CHOP plugin into the mock TouchDesigner host and cooks it from a
+// script, so a plugin can be run, debugged and profiled without
+// TouchDesigner (for example under gdb, valgrind or perf).
+//
+// usage: td_mock_cook <plugin> [script, or - for stdin] [--output path]
+//                     [--pars] [--info]
+//
+// A script has a command per line; lines starting with # are ignored:
+//
+//   par <Name> <value> [value...]    set a numeric, toggle or menu parameter
+//   string <Name> <text>             set a string, file, folder or menu
+//   dat <Name> <path>                fill a DAT parameter with a text file
+//   pulse <Name>                     press a pulse parameter
+//   input <index> <channels> sine <hz> [sample rate]
+//   input <index> <channels> noise|silence [sample rate]
+//                                    wire a generated CHOP into an input
+//   disconnect <index>               unwire an input
+//   cook <samples> [times]           cook with timeslices of <samples>
+//   info                             print the Info CHOP and Info DAT
+//
+// --output writes every cooked sample as raw 32-bit floats with the channels
+// interleaved, --pars lists the plugin's parameters, and --info prints the
+// Info CHOP and Info DAT after the last cook.
+
+#include <math.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "td_mock_host.h"
+
+namespace {
+
+// Fills a wired input before each cook, continuing where the last one
+// stopped.
+struct Generator {
+  enum Kind { kSine, kNoise, kSilence };
+
+  Kind kind = kSilence;
+  int numChannels = 1;
+  double frequency = 440.;
+  double sampleRate = 44100.;
+  double phase = 0.;
+  std::minstd_rand random;
+
+  void fill(std::vector<std::vector<float>>& channels, int numSamples) {
+    channels.resize(numChannels);
+    std::uniform_real_distribution<float> noise(-1.f, 1.f);
+    for (int i = 0; i < numSamples; i++) {
+      float value = 0.f;
+      if (kind == kSine) {
+        value = (float)sin(phase);
+        phase = fmod(phase + 2. * M_PI * frequency / sampleRate, 2. * M_PI);
+      } else if (kind == kNoise) {
+        value = noise(random);
+      }
+      for (auto& channel : channels) {
+        channel.resize(numSamples);
+        channel[i] = value;
+      }
+    }
+  }
+};
+
+void printInfo(TDMock::CHOP& chop) {
+  for (const auto& chan : chop.infoCHOP()) {
+    printf("info %s = %g\n", chan.first.c_str(), chan.second);
+  }
+  for (const auto& row : chop.infoDAT()) {
+    printf("info");
+    for (const auto& cell : row) {
+      printf(" | %s", cell.c_str());
+    }
+    printf("\n");
+  }
+}
+
+void printParameters(const TDMock::CHOP& chop) {
+  static const char* types[] = {"float",  "int",    "toggle", "pulse",
+                                "momentary", "string", "file", "folder",
+                                "menu",   "dat",    "other"};
+  for (const auto& par : chop.parameters()) {
+    printf("par %s (%s, page %s) =", par.name.c_str(), types[par.type],
+           par.page.c_str());
+    if (par.type == TDMock::Parameter::kString ||
+        par.type == TDMock::Parameter::kFile ||
+        par.type == TDMock::Parameter::kFolder ||
+        par.type == TDMock::Parameter::kMenu ||
+        par.type == TDMock::Parameter::kDAT ||
+        par.type == TDMock::Parameter::kOther) {
+      printf(" \"%s\"", par.string.c_str());
+    } else {
+      for (int i = 0; i < par.size; i++) {
+        printf(" %g", par.values[i]);
+      }
+    }
+    printf("%s\n", par.enabled ? "" : " (disabled)");
+  }
+}
+
+bool readFile(const std::string& path, std::string& text) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  text = buffer.str();
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string pluginPath, scriptPath, outputPath;
+  bool listPars = false, printLastInfo = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--output" && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (arg == "--pars") {
+      listPars = true;
+    } else if (arg == "--info") {
+      printLastInfo = true;
+    } else if (pluginPath.empty()) {
+      pluginPath = arg;
+    } else if (scriptPath.empty()) {
+      scriptPath = arg;
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (pluginPath.empty()) {
+    fprintf(stderr,
+            "usage: %s <plugin> [script, or - for stdin] [--output path] "
+            "[--pars] [--info]\n",
+            argv[0]);
+    return 1;
+  }
+
+  TDMock::Plugin plugin;
+  std::string error;
+  if (!plugin.load(pluginPath, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("loaded %s (%s)\n", plugin.opType().c_str(),
+         plugin.opLabel().c_str());
+
+  TDMock::CHOP chop(plugin);
+  if (listPars) {
+    printParameters(chop);
+  }
+
+  std::ifstream scriptFile;
+  std::istream* script = nullptr;
+  if (scriptPath == "-") {
+    script = &std::cin;
+  } else if (!scriptPath.empty()) {
+    scriptFile.open(scriptPath);
+    if (!scriptFile) {
+      fprintf(stderr, "Could not open %s\n", scriptPath.c_str());
+      return 1;
+    }
+    script = &scriptFile;
+  }
+
+  FILE* output = nullptr;
+  if (!outputPath.empty()) {
+    output = fopen(outputPath.c_str(), "wb");
+    if (!output) {
+      fprintf(stderr, "Could not open %s\n", outputPath.c_str());
+      return 1;
+    }
+  }
+
+  std::map<int, Generator> generators;
+  std::vector<float> interleaved;
+  std::string lastWarning, lastError;
+  int64_t samplesWritten = 0;
+  int failures = 0;
+
+  std::string line;
+  int lineNumber = 0;
+  while (script && std::getline(*script, line)) {
+    lineNumber++;
+    std::istringstream words(line);
+    std::string command, name;
+    if (!(words >> command) || command[0] == '#') {
+      continue;
+    }
+
+    bool ok = true;
+    if (command == "par") {
+      double value;
+      int index = 0;
+      ok = (bool)(words >> name);
+      while (ok && words >> value) {
+        ok = chop.setPar(name, value, index++);
+      }
+      ok = ok && index > 0;
+    } else if (command == "string") {
+      std::string text;
+      ok = (bool)(words >> name);
+      std::getline(words >> std::ws, text);
+      ok = ok && chop.setParString(name, text);
+    } else if (command == "dat") {
+      std::string path, text;
+      ok = words >> name >> path && readFile(path, text) &&
+           chop.setParDAT(name, text);
+    } else if (command == "pulse") {
+      ok = words >> name && chop.pulse(name);
+    } else if (command == "input") {
+      int index;
+      std::string kind;
+      Generator generator;
+      ok = (bool)(words >> index >> generator.numChannels >> kind);
+      if (kind == "sine") {
+        generator.kind = Generator::kSine;
+        ok = ok && words >> generator.frequency;
+      } else if (kind == "noise") {
+        generator.kind = Generator::kNoise;
+      } else if (kind != "silence") {
+        ok = false;
+      }
+      words >> generator.sampleRate;
+      if (ok) {
+        chop.input(index).set({}, {}, generator.sampleRate);
+        generators[index] = generator;
+      }
+    } else if (command == "disconnect") {
+      int index;
+      ok = (bool)(words >> index);
+      if (ok) {
+        chop.disconnect(index);
+        generators.erase(index);
+      }
+    } else if (command == "cook") {
+      int numSamples, times = 1;
+      ok = (bool)(words >> numSamples) && numSamples > 0;
+      words >> times;
+      for (int t = 0; ok && t < times; t++) {
+        for (auto& it : generators) {
+          it.second.fill(chop.input(it.first).channels(), numSamples);
+        }
+        if (!chop.cook(numSamples)) {
+          failures++;
+        }
+        if (chop.warning() != lastWarning) {
+          lastWarning = chop.warning();
+          printf("cook %lld: %s%s\n", (long long)chop.cookCount(),
+                 lastWarning.empty() ? "warning cleared" : "warning: ",
+                 lastWarning.c_str());
+        }
+        if (chop.error() != lastError) {
+          lastError = chop.error();
+          printf("cook %lld: %s%s\n", (long long)chop.cookCount(),
+                 lastError.empty() ? "error cleared" : "error: ",
+                 lastError.c_str());
+        }
+        if (output) {
+          const auto& channels = chop.output();
+          const size_t length = channels.empty() ? 0 : channels[0].size();
+          interleaved.resize(length * channels.size());
+          for (size_t c = 0; c < channels.size(); c++) {
+            for (size_t i = 0; i < length; i++) {
+              interleaved[i * channels.size() + c] = channels[c][i];
+            }
+          }
+          fwrite(interleaved.data(), sizeof(float), interleaved.size(),
+                 output);
+          samplesWritten += length;
+        }
+      }
+    } else if (command == "info") {
+      printInfo(chop);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "line %d: could not run \"%s\"\n", lineNumber,
+              line.c_str());
+      return 1;
+    }
+  }
+
+  if (output) {
+    fclose(output);
+  }
+  printf("%lld cooks, %d with errors, %d output channels at %g Hz",
+         (long long)chop.cookCount(), failures, (int)chop.output().size(),
+         chop.sampleRate());
+  if (output) {
+    printf(", %lld samples written to %s", (long long)samplesWritten,
+           outputPath.c_str());
+  }
+  printf("\n");
+  if (printLastInfo) {
+    printInfo(chop);
+  }
+  return failures ? 2 : 0;
+}
@@ -0,0 +1,846 @@
+#include "td_mock_host.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+// CPlusPlus_Common.h declares the plugin entry points __cdecl.
+#if !defined(_WIN32) && !defined(__cdecl)
+#define __cdecl
+#endif
+
+#include "CHOP_CPlusPlusBase.h"
+
+namespace TDMock {
+
+using namespace TD;
+
+class String : public OP_String {
+ public:
+  void setString(const char* val) override { value = val ? val : ""; }
+
+  std::string value;
+};
+
+//-----------------------------------------------------------------------------
+// name: class ParameterManager
+// desc: Records the parameters a plugin appends in setupParameters().
+//-----------------------------------------------------------------------------
+class ParameterManager : public OP_ParameterManager {
+ public:
+  OP_ParAppendResult appendFloat(const OP_NumericParameter& np,
+                                 int32_t size = 1) override;
+  OP_ParAppendResult appendInt(const OP_NumericParameter& np,
+                               int32_t size = 1) override;
+  OP_ParAppendResult appendXY(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendXYZ(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendUV(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendUVW(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendRGB(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendRGBA(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendToggle(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendPulse(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendString(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendFile(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendFolder(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendDAT(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendCHOP(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendTOP(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendObject(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendMenu(const OP_StringParameter& sp, int32_t nitems,
+                                const char** names,
+                                const char** labels) override;
+  OP_ParAppendResult appendStringMenu(const OP_StringParameter& sp,
+                                      int32_t nitems, const char** names,
+                                      const char** labels) override;
+  OP_ParAppendResult appendSOP(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendPython(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendOP(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendCOMP(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendMAT(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendPanelCOMP(const OP_StringParameter& sp) override;
+  OP_ParAppendResult appendHeader(const OP_StringParameter& np) override;
+  OP_ParAppendResult appendMomentary(const OP_NumericParameter& np) override;
+  OP_ParAppendResult appendWH(const OP_NumericParameter& np) override;
+
+  // nullptr if there is no such parameter
+  Parameter* find(const std::string& name);
+  const Parameter* find(const std::string& name) const;
+  const std::vector<Parameter>& parameters() const { return m_parameters; }
+
+ private:
+  OP_ParAppendResult append(const OP_NumericParameter& np,
+                            Parameter::Type type, int size);
+  OP_ParAppendResult append(const OP_StringParameter& sp,
+                            Parameter::Type type);
+
+  std::vector<Parameter> m_parameters;
+  std::map<std::string, size_t> m_index;
+};
+
+
+//-----------------------------------------------------------------------------
+// ParameterManager
+//-----------------------------------------------------------------------------
+
+OP_ParAppendResult ParameterManager::append(const OP_NumericParameter& np,
+                                            Parameter::Type type, int size) {
+  if (!np.name || !*np.name || m_index.count(np.name)) {
+    return OP_ParAppendResult::InvalidName;
+  }
+  if (size < 1 || size > 4) {
+    return OP_ParAppendResult::InvalidSize;
+  }
+  Parameter par;
+  par.name = np.name;
+  par.label = np.label ? np.label : np.name;
+  par.page = np.page ? np.page : "";
+  par.type = type;
+  par.size = size;
+  for (int i = 0; i < 4; i++) {
+    par.values[i] = np.defaultValues[i];
+    par.minValues[i] = np.minValues[i];
+    par.maxValues[i] = np.maxValues[i];
+    par.clampMins[i] = np.clampMins[i];
+    par.clampMaxes[i] = np.clampMaxes[i];
+  }
+  m_index[par.name] = m_parameters.size();
+  m_parameters.push_back(par);
+  return OP_ParAppendResult::Success;
+}
+
+OP_ParAppendResult ParameterManager::append(const OP_StringParameter& sp,
+                                            Parameter::Type type) {
+  if (!sp.name || !*sp.name || m_index.count(sp.name)) {
+    return OP_ParAppendResult::InvalidName;
+  }
+  Parameter par;
+  par.name = sp.name;
+  par.label = sp.label ? sp.label : sp.name;
+  par.page = sp.page ? sp.page : "";
+  par.type = type;
+  par.string = sp.defaultValue ? sp.defaultValue : "";
+  m_index[par.name] = m_parameters.size();
+  m_parameters.push_back(par);
+  return OP_ParAppendResult::Success;
+}
+
+OP_ParAppendResult ParameterManager::appendFloat(const OP_NumericParameter& np,
+                                                 int32_t size) {
+  return append(np, Parameter::kFloat, size);
+}
+
+OP_ParAppendResult ParameterManager::appendInt(const OP_NumericParameter& np,
+                                               int32_t size) {
+  return append(np, Parameter::kInt, size);
+}
+
+OP_ParAppendResult ParameterManager::appendXY(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 2);
+}
+
+OP_ParAppendResult ParameterManager::appendXYZ(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 3);
+}
+
+OP_ParAppendResult ParameterManager::appendUV(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 2);
+}
+
+OP_ParAppendResult ParameterManager::appendUVW(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 3);
+}
+
+OP_ParAppendResult ParameterManager::appendRGB(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 3);
+}
+
+OP_ParAppendResult ParameterManager::appendRGBA(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 4);
+}
+
+OP_ParAppendResult ParameterManager::appendToggle(
+    const OP_NumericParameter& np) {
+  return append(np, Parameter::kToggle, 1);
+}
+
+OP_ParAppendResult ParameterManager::appendPulse(
+    const OP_NumericParameter& np) {
+  return append(np, Parameter::kPulse, 1);
+}
+
+OP_ParAppendResult ParameterManager::appendMomentary(
+    const OP_NumericParameter& np) {
+  return append(np, Parameter::kMomentary, 1);
+}
+
+OP_ParAppendResult ParameterManager::appendWH(const OP_NumericParameter& np) {
+  return append(np, Parameter::kFloat, 2);
+}
+
+OP_ParAppendResult ParameterManager::appendString(
+    const OP_StringParameter& sp) {
+  return append(sp, Parameter::kString);
+}
+
+OP_ParAppendResult ParameterManager::appendFile(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kFile);
+}
+
+OP_ParAppendResult ParameterManager::appendFolder(
+    const OP_StringParameter& sp) {
+  return append(sp, Parameter::kFolder);
+}
+
+OP_ParAppendResult ParameterManager::appendDAT(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kDAT);
+}
+
+OP_ParAppendResult ParameterManager::appendCHOP(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendTOP(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendObject(
+    const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendSOP(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendPython(
+    const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendOP(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendCOMP(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendMAT(const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendPanelCOMP(
+    const OP_StringParameter& sp) {
+  return append(sp, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendHeader(
+    const OP_StringParameter& np) {
+  return append(np, Parameter::kOther);
+}
+
+OP_ParAppendResult ParameterManager::appendMenu(const OP_StringParameter& sp,
+                                                int32_t nitems,
+                                                const char** names,
+                                                const char** labels) {
+  OP_ParAppendResult result = append(sp, Parameter::kMenu);
+  if (result != OP_ParAppendResult::Success) {
+    return result;
+  }
+  Parameter& par = m_parameters.back();
+  for (int i = 0; i < nitems; i++) {
+    par.menuNames.push_back(names[i]);
+    par.menuLabels.push_back(labels ? labels[i] : names[i]);
+    if (par.string == names[i]) {
+      par.values[0] = i;
+    }
+  }
+  if (par.menuNames.size() && par.string.empty()) {
+    par.string = par.menuNames[0];
+  }
+  return result;
+}
+
+OP_ParAppendResult ParameterManager::appendStringMenu(
+    const OP_StringParameter& sp, int32_t nitems, const char** names,
+    const char** labels) {
+  OP_ParAppendResult result = append(sp, Parameter::kString);
+  if (result != OP_ParAppendResult::Success) {
+    return result;
+  }
+  Parameter& par = m_parameters.back();
+  for (int i = 0; i < nitems; i++) {
+    par.menuNames.push_back(names[i]);
+    par.menuLabels.push_back(labels ? labels[i] : names[i]);
+  }
+  return result;
+}
+
+Parameter* ParameterManager::find(const std::string& name) {
+  auto it = m_index.find(name);
+  return it == m_index.end() ? nullptr : &m_parameters[it->second];
+}
+
+const Parameter* ParameterManager::find(const std::string& name) const {
+  auto it = m_index.find(name);
+  return it == m_index.end() ? nullptr : &m_parameters[it->second];
+}
+
+//-----------------------------------------------------------------------------
+// CHOPInput
+//-----------------------------------------------------------------------------
+
+void CHOPInput::set(std::vector<std::vector<float>> channels,
+                    std::vector<std::string> names, double sampleRate) {
+  m_channels = std::move(channels);
+  m_names = std::move(names);
+  m_sampleRate = sampleRate;
+  m_windowStart = 0;
+  m_windowLength = -1;
+}
+
+//-----------------------------------------------------------------------------
+// name: struct Plugin::Library
+// desc: The loaded library and what FillCHOPPluginInfo filled in.
+//-----------------------------------------------------------------------------
+struct Plugin::Library {
+  void* handle = nullptr;
+  CREATECHOPINSTANCE create = nullptr;
+  DESTROYCHOPINSTANCE destroy = nullptr;
+  CHOP_PluginInfo info;
+  String opType, opLabel, opIcon, authorName, authorEmail, pythonVersion;
+};
+
+//-----------------------------------------------------------------------------
+// name: struct CHOP::Node
+// desc: What TouchDesigner keeps for a node and hands to the plugin.
+//-----------------------------------------------------------------------------
+struct CHOP::Node {
+  std::string opPath;
+  OP_NodeInfo nodeInfo = {};
+  CHOP_CPlusPlusBase* instance = nullptr;
+  ParameterManager parameters;
+  Inputs* inputs = nullptr;
+  struct DAT {
+    std::string text;
+    const char* cell = nullptr;
+    OP_DATInput input = {};
+  };
+  std::map<std::string, DAT> dats;
+  OP_TimeInfo timeInfo = {};
+
+  std::vector<float*> channelPtrs;
+  std::vector<const char*> namePtrs;
+};
+
+//-----------------------------------------------------------------------------
+// name: class Inputs
+// desc: What the plugin sees of its node during a cook.
+//-----------------------------------------------------------------------------
+class Inputs final : public OP_Inputs {
+ public:
+  explicit Inputs(CHOP* chop) : m_chop(chop) {}
+
+  int32_t getNumInputs() const override {
+    return m_chop->m_chopInputs.empty()
+               ? 0
+               : m_chop->m_chopInputs.rbegin()->first + 1;
+  }
+
+  const OP_CHOPInput* getInputCHOP(int32_t index) const override {
+    auto it = m_chop->m_chopInputs.find(index);
+    if (it == m_chop->m_chopInputs.end()) {
+      return nullptr;
+    }
+    CHOPInput& chop = it->second;
+    Wired& wired = m_wired[index];
+    // The channels may have been refilled (or resized) since the last cook.
+    for (size_t i = chop.m_names.size(); i < chop.m_channels.size(); i++) {
+      chop.m_names.push_back("chan" + std::to_string(i + 1));
+    }
+    wired.channelData.resize(chop.m_channels.size());
+    wired.nameData.resize(chop.m_channels.size());
+    const int32_t length =
+        chop.m_channels.empty() ? 0 : (int32_t)chop.m_channels[0].size();
+    const int32_t start = std::min(std::max(chop.m_windowStart, 0), length);
+    for (size_t i = 0; i < chop.m_channels.size(); i++) {
+      wired.channelData[i] = chop.m_channels[i].data() + start;
+      wired.nameData[i] = chop.m_names[i].c_str();
+    }
+    OP_CHOPInput& input = wired.input;
+    input = {};
+    input.opPath = "/input";
+    input.sampleRate = chop.m_sampleRate;
+    input.numChannels = (int32_t)chop.m_channels.size();
+    input.numSamples = chop.m_windowLength < 0
+                           ? length - start
+                           : std::min(chop.m_windowLength, length - start);
+    input.startIndex = start;
+    input.channelData = wired.channelData.data();
+    input.nameData = wired.nameData.data();
+    input.totalCooks = m_chop->cookCount();
+    return &input;
+  }
+
+  const OP_DATInput* getParDAT(const char* name) const override {
+    const Parameter* par = m_chop->m_node->parameters.find(name);
+    if (!par || par->string.empty()) {
+      return nullptr;
+    }
+    auto it = m_chop->m_node->dats.find(name);
+    return it == m_chop->m_node->dats.end() ? nullptr : &it->second.input;
+  }
+
+  double getParDouble(const char* name, int32_t index = 0) const override {
+    const Parameter* par = m_chop->m_node->parameters.find(name);
+    return par && index >= 0 && index < 4 ? par->values[index] : 0.;
+  }
+
+  bool getParDouble2(const char* name, double& v0,
+                     double& v1) const override {
+    const Parameter* par = m_chop->m_node->parameters.find(name);
+    if (!par) {
+      return false;
+    }
+    v0 = par->values[0];
+    v1 = par->values[1];
+    return true;
+  }
+
+  bool getParDouble3(const char* name, double& v0, double& v1,
+                     double& v2) const override {
+    const Parameter* par = m_chop->m_node->parameters.find(name);
+    if (!par) {
+      return false;
+    }
+    v0 = par->values[0];
+    v1 = par->values[1];
+    v2 = par->values[2];
+    return true;
+  }
+
+  bool getParDouble4(const char* name, double& v0, double& v1, double& v2,
+                     double& v3) const override {
+    const Parameter* par = m_chop->m_node->parameters.find(name);
+    if (!par) {
+      return false;
+    }
+    v0 = par->values[0];
+    v1 = par->values[1];
+    v2 = par->values[2];
+    v3 = par->values[3];
+    return true;
+  }
+
+  int32_t getParInt(const char* name, int32_t index = 0) const override {
+    return (int32_t)getParDouble(name, index);
+  }
+
+  bool getParInt2(const char* name, int32_t& v0, int32_t& v1) const override {
+    double d0, d1;
+    if (!getParDouble2(name, d0, d1)) {
+      return false;
+    }
+    v0 = (int32_t)d0;
+    v1 = (int32_t)d1;
+    return true;
+  }
+
+  bool getParInt3(const char* name, int32_t& v0, int32_t& v1,
+                  int32_t& v2) const override {
+    double d0, d1, d2;
+    if (!getParDouble3(name, d0, d1, d2)) {
+      return false;
+    }
+    v0 = (int32_t)d0;
+    v1 = (int32_t)d1;
+    v2 = (int32_t)d2;
+    return true;
+  }
+
+  bool getParInt4(const char* name, int32_t& v0, int32_t& v1, int32_t& v2,
+                  int32_t& v3) const override {
+    double d0, d1, d2, d3;
+    if (!getParDouble4(name, d0, d1, d2, d3)) {
+      return false;
+    }
+    v0 = (int32_t)d0;
+    v1 = (int32_t)d1;
+    v2 = (int32_t)d2;
+    v3 = (int32_t)d3;
+    return true;
+  }
+
+  const char* getParString(const char* name) const override {
+    const Parameter* par = m_chop->m_node->parameters.find(name);
+    return par ? par->string.c_str() : "";
+  }
+
+  const char* getParFilePath(const char* name) const override {
+    return getParString(name);
+  }
+
+  void enablePar(const char* name, bool onoff) const override {
+    Parameter* par = m_chop->m_node->parameters.find(name);
+    if (par) {
+      par->enabled = onoff;
+    }
+  }
+
+  const OP_TimeInfo* getTimeInfo() const override {
+    return &m_chop->m_node->timeInfo;
+  }
+
+  // Nothing else exists in the mock host.
+  const OP_TOPInputOpenGL* getInputTOPOpenGL(int32_t) const override {
+    return nullptr;
+  }
+  const OP_TOPInputOpenGL* getParTOPOpenGL(const char*) const override {
+    return nullptr;
+  }
+  const OP_CHOPInput* getParCHOP(const char*) const override {
+    return nullptr;
+  }
+  const OP_ObjectInput* getParObject(const char*) const override {
+    return nullptr;
+  }
+  bool getRelativeTransform(const char*, const char*,
+                            double[4][4]) const override {
+    return false;
+  }
+  const OP_DATInput* getDAT(const char*) const override { return nullptr; }
+  const OP_TOPInputOpenGL* getTOPOpenGL(const char*) const override {
+    return nullptr;
+  }
+  const OP_CHOPInput* getCHOP(const char*) const override { return nullptr; }
+  const OP_ObjectInput* getObject(const char*) const override {
+    return nullptr;
+  }
+  const OP_SOPInput* getParSOP(const char*) const override { return nullptr; }
+  const OP_SOPInput* getInputSOP(int32_t) const override { return nullptr; }
+  const OP_SOPInput* getSOP(const char*) const override { return nullptr; }
+  const OP_DATInput* getInputDAT(int32_t) const override { return nullptr; }
+  PyObject* getParPython(const char*) const override { return nullptr; }
+  const OP_TOPInput* getTOP(const char*) const override { return nullptr; }
+  const OP_TOPInput* getInputTOP(int32_t) const override { return nullptr; }
+  const OP_TOPInput* getParTOP(const char*) const override { return nullptr; }
+
+ private:
+  void* getTOPDataInCPUMemory(
+      const OP_TOPInputOpenGL*,
+      const OP_TOPInputDownloadOptionsOpenGL*) const override {
+    return nullptr;
+  }
+
+  // What getInputCHOP() hands out for each wired input
+  struct Wired {
+    std::vector<const float*> channelData;
+    std::vector<const char*> nameData;
+    OP_CHOPInput input = {};
+  };
+
+  CHOP* m_chop;
+  mutable std::map<int, Wired> m_wired;
+};
+
+//-----------------------------------------------------------------------------
+// Plugin
+//-----------------------------------------------------------------------------
+
+Plugin::Plugin() = default;
+
+Plugin::~Plugin() {
+  if (!m_library || !m_library->handle) {
+    return;
+  }
+#ifdef _WIN32
+  FreeLibrary((HMODULE)m_library->handle);
+#else
+  dlclose(m_library->handle);
+#endif
+}
+
+bool Plugin::load(const std::string& path, std::string& error) {
+#ifdef _WIN32
+  HMODULE library = LoadLibraryA(path.c_str());
+  if (!library) {
+    error = "Could not load " + path + " (error " +
+            std::to_string(GetLastError()) + ")";
+    return false;
+  }
+  auto symbol = [&](const char* name) {
+    return (void*)GetProcAddress(library, name);
+  };
+#else
+  void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    error = dlerror();
+    return false;
+  }
+  auto symbol = [&](const char* name) { return dlsym(library, name); };
+#endif
+  m_library.reset(new Library());
+  m_library->handle = library;
+  m_path = path;
+
+  Library& lib = *m_library;
+  FILLCHOPPLUGININFO fill = (FILLCHOPPLUGININFO)symbol("FillCHOPPluginInfo");
+  lib.create = (CREATECHOPINSTANCE)symbol("CreateCHOPInstance");
+  lib.destroy = (DESTROYCHOPINSTANCE)symbol("DestroyCHOPInstance");
+  if (!fill || !lib.create || !lib.destroy) {
+    error = path + " is not a CHOP plugin (FillCHOPPluginInfo, "
+            "CreateCHOPInstance or DestroyCHOPInstance is missing)";
+    return false;
+  }
+
+  lib.info.customOPInfo.opType = &lib.opType;
+  lib.info.customOPInfo.opLabel = &lib.opLabel;
+  lib.info.customOPInfo.opIcon = &lib.opIcon;
+  lib.info.customOPInfo.authorName = &lib.authorName;
+  lib.info.customOPInfo.authorEmail = &lib.authorEmail;
+  lib.info.customOPInfo.pythonVersion = &lib.pythonVersion;
+  fill(&lib.info);
+  m_opType = lib.opType.value;
+  m_opLabel = lib.opLabel.value;
+  if (lib.info.apiVersion != CHOPCPlusPlusAPIVersion) {
+    error = path + " uses CHOP API version " +
+            std::to_string(lib.info.apiVersion) +
+            ", the mock host supports " +
+            std::to_string(CHOPCPlusPlusAPIVersion);
+    return false;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// CHOP
+//-----------------------------------------------------------------------------
+
+CHOP::CHOP(const Plugin& plugin, const std::string& opPath)
+    : m_plugin(plugin), m_node(new Node()) {
+  static uint32_t nextId = 1;
+  m_node->opPath = opPath;
+  m_node->nodeInfo.opPath = m_node->opPath.c_str();
+  m_node->nodeInfo.opId = nextId++;
+  m_node->nodeInfo.pluginPath = m_plugin.path().c_str();
+  // No Python: plugins must not rely on it while hosted here.
+  m_node->nodeInfo.context = nullptr;
+
+  // TouchDesigner's default 60 FPS timeline
+  m_node->timeInfo.rate = m_node->timeInfo.rootRate = 60.;
+
+  m_node->inputs = new Inputs(this);
+  const Plugin::Library* lib = m_plugin.m_library.get();
+  if (lib && lib->create) {
+    m_node->instance = lib->create(&m_node->nodeInfo);
+  }
+  if (m_node->instance) {
+    m_node->instance->setupParameters(&m_node->parameters, nullptr);
+  }
+}
+
+CHOP::~CHOP() {
+  const Plugin::Library* lib = m_plugin.m_library.get();
+  if (lib && lib->destroy && m_node->instance) {
+    lib->destroy(m_node->instance);
+  }
+  delete m_node->inputs;
+}
+
+bool CHOP::setPar(const std::string& name, double value, int index) {
+  Parameter* par = m_node->parameters.find(name);
+  if (!par || index < 0 || index >= par->size) {
+    return false;
+  }
+  if (par->clampMins[index]) {
+    value = std::max(value, par->minValues[index]);
+  }
+  if (par->clampMaxes[index]) {
+    value = std::min(value, par->maxValues[index]);
+  }
+  if (par->type == Parameter::kMenu) {
+    if (value < 0 || value >= par->menuNames.size()) {
+      return false;
+    }
+    par->string = par->menuNames[(size_t)value];
+  }
+  par->values[index] = value;
+  return true;
+}
+
+bool CHOP::setParString(const std::string& name, const std::string& value) {
+  Parameter* par = m_node->parameters.find(name);
+  if (!par) {
+    return false;
+  }
+  if (par->type == Parameter::kMenu) {
+    auto it = std::find(par->menuNames.begin(), par->menuNames.end(), value);
+    if (it == par->menuNames.end()) {
+      return false;
+    }
+    par->values[0] = (double)(it - par->menuNames.begin());
+  }
+  par->string = value;
+  return true;
+}
+
+bool CHOP::setParDAT(const std::string& name, const std::string& text) {
+  Parameter* par = m_node->parameters.find(name);
+  if (!par || par->type != Parameter::kDAT) {
+    return false;
+  }
+  par->string = "/dat_" + name;
+  Node::DAT& dat = m_node->dats[name];
+  dat.text = text;
+  dat.cell = dat.text.c_str();
+  dat.input = {};
+  dat.input.opPath = par->string.c_str();
+  dat.input.numRows = dat.input.numCols = 1;
+  dat.input.isTable = false;
+  dat.input.cellData = &dat.cell;
+  dat.input.totalCooks = 1;
+  return true;
+}
+
+bool CHOP::pulse(const std::string& name) {
+  if (!m_node->parameters.find(name) || !m_node->instance) {
+    return false;
+  }
+  m_node->instance->pulsePressed(name.c_str(), nullptr);
+  return true;
+}
+
+const Parameter* CHOP::par(const std::string& name) const {
+  return m_node->parameters.find(name);
+}
+
+const std::vector<Parameter>& CHOP::parameters() const {
+  return m_node->parameters.parameters();
+}
+
+int64_t CHOP::cookCount() const { return m_node->nodeInfo.cookCount; }
+
+CHOPInput& CHOP::input(int index) { return m_chopInputs[index]; }
+
+void CHOP::disconnect(int index) { m_chopInputs.erase(index); }
+
+bool CHOP::cook(int numSamples) {
+  if (!m_node->instance) {
+    m_error = "The plugin did not create an instance";
+    return false;
+  }
+
+  m_node->nodeInfo.cookCount++;
+  const bool first = m_node->nodeInfo.cookCount == 1;
+  m_node->timeInfo.absFrame++;
+  m_node->timeInfo.frame += 1.;
+  m_node->timeInfo.rootFrame += 1.;
+  m_node->timeInfo.deltaFrames = first ? 0. : 1.;
+  m_node->timeInfo.deltaMS = m_node->timeInfo.deltaFrames * 1000. / m_node->timeInfo.rate;
+
+  CHOP_GeneralInfo general = {};
+  m_node->instance->getGeneralInfo(&general, m_node->inputs, nullptr);
+
+  // Defaults match the input, as they do in TouchDesigner.
+  const OP_CHOPInput* match = m_node->inputs->getInputCHOP(general.inputMatchIndex);
+  CHOP_OutputInfo info = {};
+  info.numChannels = match ? match->numChannels : 0;
+  info.numSamples = match ? match->numSamples : 1;
+  info.sampleRate = match ? (float)match->sampleRate : (float)m_node->timeInfo.rate;
+  const bool custom = m_node->instance->getOutputInfo(&info, m_node->inputs, nullptr);
+  if (general.timeslice) {
+    // TouchDesigner derives this from the frames elapsed since the last
+    // cook; here the caller picks it.
+    info.numSamples = numSamples;
+  }
+  if (!custom && !match) {
+    info.numChannels = 0;
+  }
+
+  m_names.resize(std::max(info.numChannels, 0));
+  String name;
+  for (int i = 0; i < (int)m_names.size(); i++) {
+    if (custom) {
+      name.value.clear();
+      m_node->instance->getChannelName(i, &name, m_node->inputs, nullptr);
+      m_names[i] = name.value;
+    } else {
+      m_names[i] = match->getChannelName(i);
+    }
+  }
+
+  m_output.resize(m_names.size());
+  m_node->channelPtrs.resize(m_names.size());
+  m_node->namePtrs.resize(m_names.size());
+  for (size_t i = 0; i < m_output.size(); i++) {
+    m_output[i].resize(std::max(info.numSamples, 0));
+    m_node->channelPtrs[i] = m_output[i].data();
+    m_node->namePtrs[i] = m_names[i].c_str();
+  }
+  m_sampleRate = info.sampleRate;
+
+  CHOP_Output output((int32_t)m_output.size(), std::max(info.numSamples, 0),
+                     info.sampleRate, info.startIndex, m_node->channelPtrs.data(),
+                     m_node->namePtrs.data());
+  m_node->instance->execute(&output, m_node->inputs, nullptr);
+
+  String warning, error;
+  m_node->instance->getWarningString(&warning, nullptr);
+  m_node->instance->getErrorString(&error, nullptr);
+  m_warning = warning.value;
+  m_error = error.value;
+  return m_error.empty();
+}
+
+std::vector<std::pair<std::string, float>> CHOP::infoCHOP() {
+  std::vector<std::pair<std::string, float>> chans;
+  if (!m_node->instance) {
+    return chans;
+  }
+  const int32_t n = m_node->instance->getNumInfoCHOPChans(nullptr);
+  for (int32_t i = 0; i < n; i++) {
+    String name;
+    OP_InfoCHOPChan chan = {};
+    chan.name = &name;
+    m_node->instance->getInfoCHOPChan(i, &chan, nullptr);
+    chans.emplace_back(name.value, chan.value);
+  }
+  return chans;
+}
+
+std::vector<std::vector<std::string>> CHOP::infoDAT() {
+  std::vector<std::vector<std::string>> table;
+  OP_InfoDATSize size = {};
+  if (!m_node->instance || !m_node->instance->getInfoDATSize(&size, nullptr)) {
+    return table;
+  }
+  table.assign(std::max(size.rows, 0),
+               std::vector<std::string>(std::max(size.cols, 0)));
+  const int32_t lines = size.byColumn ? size.cols : size.rows;
+  const int32_t entries = size.byColumn ? size.rows : size.cols;
+  std::vector<String> strings(std::max(entries, 0));
+  std::vector<OP_String*> values(strings.size());
+  for (int32_t line = 0; line < lines; line++) {
+    for (size_t i = 0; i < strings.size(); i++) {
+      strings[i].value.clear();
+      values[i] = &strings[i];
+    }
+    OP_InfoDATEntries dat = {};
+    dat.values = values.data();
+    m_node->instance->getInfoDATEntries(line, entries, &dat, nullptr);
+    for (int32_t i = 0; i < entries; i++) {
+      if (size.byColumn) {
+        table[i][line] = strings[i].value;
+      } else {
+        table[line][i] = strings[i].value;
+      }
+    }
+  }
+  return table;
+}
+
+}  // namespace TDMock
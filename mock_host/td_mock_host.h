@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A headless stand-in for TouchDesigner that loads a CHOP plugin the way
+// TouchDesigner does (FillCHOPPluginInfo, CreateCHOPInstance,
+// DestroyCHOPInstance), sets its parameters and inputs, and cooks it with
+// timeslices of any length, so the plugins can be tested, benchmarked and
+// profiled without TouchDesigner. The TouchDesigner headers stay inside
+// td_mock_host.cpp, so users of the host don't compile them.
+namespace TDMock {
+
+struct Parameter {
+  enum Type {
+    kFloat,
+    kInt,
+    kToggle,
+    kPulse,
+    kMomentary,
+    kString,
+    kFile,
+    kFolder,
+    kMenu,
+    kDAT,
+    kOther  // CHOP, TOP, COMP, Python, ...: read as empty
+  };
+
+  std::string name;
+  std::string label;
+  std::string page;
+  Type type = kFloat;
+  int size = 1;
+  double values[4] = {0., 0., 0., 0.};
+  double minValues[4] = {0., 0., 0., 0.};
+  double maxValues[4] = {1., 1., 1., 1.};
+  bool clampMins[4] = {false, false, false, false};
+  bool clampMaxes[4] = {false, false, false, false};
+  std::string string;
+  std::vector<std::string> menuNames;
+  std::vector<std::string> menuLabels;
+  bool enabled = true;
+};
+
+class Inputs;
+
+//-----------------------------------------------------------------------------
+// name: class CHOPInput
+// desc: The channels of a CHOP wired into the plugin, or of a CHOP
+//       parameter.
+//-----------------------------------------------------------------------------
+class CHOPInput {
+ public:
+  // Every channel must have the same length. Channels without a name are
+  // called chan1, chan2, ... The channels can also be refilled in place
+  // between cooks.
+  void set(std::vector<std::vector<float>> channels,
+           std::vector<std::string> names = {}, double sampleRate = 44100.);
+
+  std::vector<std::vector<float>>& channels() { return m_channels; }
+
+  // Show the plugin only `length` samples from `start` on, to play a long
+  // recording a timeslice per cook without copying it. A negative length
+  // shows all of it.
+  void setWindow(int start, int length) {
+    m_windowStart = start;
+    m_windowLength = length;
+  }
+
+  double sampleRate() const { return m_sampleRate; }
+
+ private:
+  friend class Inputs;
+
+  std::vector<std::vector<float>> m_channels;
+  std::vector<std::string> m_names;
+  double m_sampleRate = 44100.;
+  int m_windowStart = 0;
+  int m_windowLength = -1;
+};
+
+//-----------------------------------------------------------------------------
+// name: class Plugin
+// desc: A CHOP plugin library, loaded as TouchDesigner loads it.
+//-----------------------------------------------------------------------------
+class Plugin {
+ public:
+  Plugin();
+  ~Plugin();
+
+  // false, with `error` set, if the library or its entry points can't be
+  // found.
+  bool load(const std::string& path, std::string& error);
+
+  const std::string& path() const { return m_path; }
+  const std::string& opType() const { return m_opType; }
+  const std::string& opLabel() const { return m_opLabel; }
+
+ private:
+  friend class CHOP;
+  struct Library;
+
+  std::unique_ptr<Library> m_library;
+  std::string m_path;
+  std::string m_opType, m_opLabel;
+};
+
+//-----------------------------------------------------------------------------
+// name: class CHOP
+// desc: An instance of a plugin, with its parameters, inputs and the output
+//       of its last cook.
+//-----------------------------------------------------------------------------
+class CHOP {
+ public:
+  explicit CHOP(const Plugin& plugin, const std::string& opPath = "/chop1");
+  ~CHOP();
+
+  // Parameters, false if there is no such parameter. Menus are set by
+  // index with setPar() or by name with setParString(). A DAT parameter is
+  // a 1x1 table holding `text`.
+  bool setPar(const std::string& name, double value, int index = 0);
+  bool setParString(const std::string& name, const std::string& value);
+  bool setParDAT(const std::string& name, const std::string& text);
+  bool pulse(const std::string& name);
+  const Parameter* par(const std::string& name) const;
+  const std::vector<Parameter>& parameters() const;
+
+  // The CHOP wired into input `index`. Unwired until set.
+  CHOPInput& input(int index);
+  void disconnect(int index);
+
+  // Cook once with a timeslice of `numSamples`, in the order TouchDesigner
+  // calls the plugin. Returns false if the plugin reports an error.
+  bool cook(int numSamples);
+
+  // The output of the last cook
+  const std::vector<std::vector<float>>& output() const { return m_output; }
+  const std::vector<std::string>& channelNames() const { return m_names; }
+  float sampleRate() const { return m_sampleRate; }
+  const std::string& warning() const { return m_warning; }
+  const std::string& error() const { return m_error; }
+  int64_t cookCount() const;
+
+  // The Info CHOP and Info DAT, asked of the plugin when called.
+  std::vector<std::pair<std::string, float>> infoCHOP();
+  std::vector<std::vector<std::string>> infoDAT();
+
+ private:
+  friend class Inputs;
+  struct Node;
+
+  const Plugin& m_plugin;
+  std::unique_ptr<Node> m_node;
+  std::map<int, CHOPInput> m_chopInputs;
+
+  std::vector<std::vector<float>> m_output;
+  std::vector<std::string> m_names;
+  float m_sampleRate = 60.f;
+  std::string m_warning, m_error;
+};
+
+}  // namespace TDMock